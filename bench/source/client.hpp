@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace bench
+{
+
+/* A blocking websocket client speaking just enough RFC 6455 to drive the server:
+ * unfragmented frames, no extensions, masked sends. One per thread. */
+class Client
+{
+public:
+  enum class opcode_t : uint8_t
+  {
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xA,
+  };
+
+  struct frame_t
+  {
+    opcode_t opcode;
+    std::string_view payload;
+  };
+
+public:
+  Client(const std::string& host, int port, std::string_view protocol = {})
+  {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || !res)
+      throw std::runtime_error(fmt::format("Unresolved {}:{}", host, port));
+    for (auto* ai = res; ai; ai = ai->ai_next) {
+      fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) continue;
+      if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+      ::close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) throw std::runtime_error(fmt::format("Unavailable {}:{}", host, port));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    handshake(host, port, protocol);
+  }
+
+  ~Client()
+  {
+    if (fd < 0) return;
+    try {
+      send(opcode_t::CLOSE, {});
+    }
+    catch (...) {
+    }
+    ::close(fd);
+  }
+
+  Client(const Client&) = delete;
+  Client(Client&&) = delete;
+  Client& operator=(const Client&) = delete;
+  Client& operator=(Client&&) = delete;
+
+  void send(opcode_t opcode, std::string_view payload)
+  {
+    out.clear();
+    out += char(0x80 | uint8_t(opcode));
+    if (payload.size() < 126) {
+      out += char(0x80 | payload.size());
+    }
+    else if (payload.size() <= 0xFFFF) {
+      out += char(0x80 | 126);
+      for (int i = 1; i >= 0; --i) out += char(payload.size() >> (8 * i));
+    }
+    else {
+      out += char(0x80 | 127);
+      for (int i = 7; i >= 0; --i) out += char(uint64_t(payload.size()) >> (8 * i));
+    }
+    std::array<char, 4> mask{};
+    for (auto& m : mask) m = char(rng());
+    out.append(mask.data(), mask.size());
+    auto begin = out.size();
+    out += payload;
+    for (size_t i = 0; i < payload.size(); ++i) out[begin + i] ^= mask[i & 3];
+    write(out);
+  }
+
+  /* Blocks for the next data frame, answering pings on the way; the payload lives until the next call */
+  frame_t receive()
+  {
+    for (;;) {
+      fill(2);
+      auto at = [this](size_t i) { return uint8_t(in[head + i]); };
+      auto opcode = opcode_t(at(0) & 0x0F);
+      uint64_t size = at(1) & 0x7F;
+      size_t header = 2;
+      if (size == 126) {
+        fill(header + 2);
+        size = (uint64_t(at(2)) << 8) | at(3);
+        header += 2;
+      }
+      else if (size == 127) {
+        fill(header + 8);
+        size = 0;
+        for (size_t i = 0; i < 8; ++i) size = (size << 8) | at(2 + i);
+        header += 8;
+      }
+      fill(header + size);
+      auto payload = std::string_view(in).substr(head + header, size);
+      head += header + size;
+      switch (opcode) {
+        case opcode_t::PING:
+          send(opcode_t::PONG, std::string(payload));
+          continue;
+        case opcode_t::PONG:
+          continue;
+        case opcode_t::CLOSE:
+          throw std::runtime_error("Closed by server");
+        default:
+          return {opcode, payload};
+      }
+    }
+  }
+
+private:
+  void handshake(const std::string& host, int port, std::string_view protocol)
+  {
+    auto request = fmt::format(
+      "GET / HTTP/1.1\r\n"
+      "Host: {}:{}\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n",
+      host,
+      port);
+    if (!protocol.empty()) request += fmt::format("Sec-WebSocket-Protocol: {}\r\n", protocol);
+    request += "\r\n";
+    write(request);
+    size_t end;
+    while ((end = in.find("\r\n\r\n")) == in.npos) read();
+    if (!in.starts_with("HTTP/1.1 101")) throw std::runtime_error("Upgrade refused: " + in.substr(0, in.find('\r')));
+    head = end + 4;
+  }
+
+  /* Until size bytes past head are buffered */
+  void fill(size_t size)
+  {
+    while (in.size() - head < size) read();
+  }
+
+  void read()
+  {
+    /* Only a partial frame is left by now, cheap to move to the front */
+    in.erase(0, head);
+    head = 0;
+    std::array<char, 64 * 1024> buffer;
+    auto n = ::recv(fd, buffer.data(), buffer.size(), 0);
+    if (n <= 0) throw std::runtime_error("Connection lost");
+    in.append(buffer.data(), n);
+  }
+
+  void write(std::string_view data)
+  {
+    while (!data.empty()) {
+      auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (n <= 0) throw std::runtime_error("Connection lost");
+      data.remove_prefix(n);
+    }
+  }
+
+private:
+  int fd = -1;
+  std::string in = {};
+  size_t head = 0;
+  std::string out = {};
+  std::minstd_rand rng{std::random_device{}()};
+};
+
+}  // namespace bench
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cxxopts.hpp>
+#include <fmt/format.h>
+#include <glaze/glaze.hpp>
+
+#include <wsrpc/version.h>
+#include <wsrpc/wsrpc.h>
+
+#include "client.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+struct config_t
+{
+  std::string host;
+  int port;
+  size_t connections;
+  size_t inflight;
+  size_t calls;
+  size_t duration_secs;
+  std::vector<std::string> methods;
+  size_t payload;
+  size_t attachs;
+  size_t attach_size;
+};
+
+/* What one connection measured */
+struct result_t
+{
+  std::vector<uint64_t> latencies_ns = {};
+  size_t errors = 0;
+  std::string failure = {};
+};
+
+struct latency_t
+{
+  double min;
+  double mean;
+  double p50;
+  double p90;
+  double p99;
+  double p999;
+  double max;
+};
+
+struct report_t
+{
+  std::string version;
+  std::string target;
+  size_t connections;
+  size_t inflight;
+  std::vector<std::string> methods;
+  size_t payload;
+  size_t attachs;
+  size_t attach_size;
+  size_t calls;
+  size_t errors;
+  size_t failures;
+  double seconds;
+  double throughput;
+  latency_t latency_us;
+  /* Power of two buckets in microseconds: upper bound, count */
+  std::vector<std::array<uint64_t, 2>> histogram;
+};
+
+/* Keeps inflight calls going on one connection, each slot holding one outstanding call */
+static void drive(const config_t& config, clock_type::time_point until, result_t& result)
+{
+  try {
+    bench::Client client(config.host, config.port);
+    const auto params = '"' + std::string(config.payload, 'x') + '"';
+    const auto attach = std::string(config.attach_size, '\0');
+    std::vector<clock_type::time_point> sent(config.inflight);
+    std::string request;
+    size_t issued = 0;
+    size_t outstanding = 0;
+
+    auto more = [&]() { return config.duration_secs ? clock_type::now() < until : issued < config.calls; };
+    auto issue = [&](size_t slot) {
+      for (size_t i = 0; i < config.attachs; ++i) client.send(bench::Client::opcode_t::BINARY, attach);
+      const auto& method = config.methods[issued % config.methods.size()];
+      request.clear();
+      fmt::format_to(std::back_inserter(request), R"({{"id":"{}","method":"{}","params":{})", slot, method, params);
+      if (config.attachs) fmt::format_to(std::back_inserter(request), R"(,"attachs":{})", config.attachs);
+      request += '}';
+      sent[slot] = clock_type::now();
+      client.send(bench::Client::opcode_t::TEXT, request);
+      issued++;
+      outstanding++;
+    };
+
+    result.latencies_ns.reserve(config.duration_secs ? 1 << 16 : config.calls);
+    for (size_t slot = 0; slot < config.inflight && more(); ++slot) issue(slot);
+    while (outstanding) {
+      auto [opcode, payload] = client.receive();
+      /* Attachments of a reply come ahead of it */
+      if (opcode != bench::Client::opcode_t::TEXT) continue;
+      if (payload.find(R"("partial":true)") != payload.npos) continue;
+      /* A reply not naming its slot still answers a call, whose slot is left idle as it cannot be told */
+      constexpr std::string_view key = R"("id":")";
+      auto pos = payload.find(key);
+      size_t slot = sent.size();
+      if (pos != payload.npos) {
+        slot = 0;
+        for (pos += key.size(); pos < payload.size() && payload[pos] != '"'; ++pos)  //
+          slot = slot * 10 + (payload[pos] - '0');
+      }
+      if (slot >= sent.size()) {
+        result.errors++;
+        outstanding--;
+        continue;
+      }
+      auto latency = clock_type::now() - sent[slot];
+      result.latencies_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+      if (payload.find(R"("error":)") != payload.npos) result.errors++;
+      outstanding--;
+      if (more()) issue(slot);
+    }
+  }
+  catch (const std::exception& e) {
+    result.failure = e.what();
+  }
+}
+
+static report_t summarize(const config_t& config, std::vector<result_t>& results, double seconds)
+{
+  std::vector<uint64_t> all;
+  report_t report{
+    .version = WSRPC_VERSION,
+    .target = fmt::format("ws://{}:{}", config.host, config.port),
+    .connections = config.connections,
+    .inflight = config.inflight,
+    .methods = config.methods,
+    .payload = config.payload,
+    .attachs = config.attachs,
+    .attach_size = config.attach_size,
+  };
+  for (auto& result : results) {
+    all.insert(all.end(), result.latencies_ns.begin(), result.latencies_ns.end());
+    report.errors += result.errors;
+    if (!result.failure.empty()) {
+      std::cerr << "Connection failed: " << result.failure << std::endl;
+      report.failures++;
+    }
+  }
+  std::ranges::sort(all);
+  report.calls = all.size();
+  report.seconds = seconds;
+  report.throughput = seconds > 0 ? all.size() / seconds : 0;
+  if (all.empty()) return report;
+
+  auto us = [](double ns) { return ns / 1e3; };
+  auto at = [&all](double q) { return all[std::min(all.size() - 1, size_t(q * all.size()))]; };
+  double sum = 0;
+  for (auto ns : all) sum += ns;
+  report.latency_us = {
+    .min = us(all.front()),
+    .mean = us(sum / all.size()),
+    .p50 = us(at(0.50)),
+    .p90 = us(at(0.90)),
+    .p99 = us(at(0.99)),
+    .p999 = us(at(0.999)),
+    .max = us(all.back()),
+  };
+  uint64_t bound = 1;
+  auto it = all.begin();
+  while (it != all.end()) {
+    auto end = std::ranges::upper_bound(it, all.end(), bound * 1000);
+    if (end != it) report.histogram.push_back({bound, uint64_t(end - it)});
+    it = end;
+    bound *= 2;
+  }
+  return report;
+}
+
+auto cli(const int argc, const char* const argv[]) -> std::pair<config_t, cxxopts::ParseResult>
+{
+  cxxopts::Options options(*argv, "A load generator for wsrpc servers");
+  options.add_options()                                                                                  //
+    ("help", "Print the help")                                                                           //
+    ("version", "Print the version number")                                                              //
+    ("h,host", "Set the server host", cxxopts::value<std::string>()->default_value("127.0.0.1"))         //
+    ("p,port", "Set the server port", cxxopts::value<int>()->default_value("8080"))                      //
+    ("c,connections", "Set the connections", cxxopts::value<size_t>()->default_value("8"))               //
+    ("k,inflight", "Set the calls in flight each", cxxopts::value<size_t>()->default_value("16"))        //
+    ("n,calls", "Set the calls each", cxxopts::value<size_t>()->default_value("10000"))                  //
+    ("d,duration", "Run for seconds instead", cxxopts::value<size_t>()->default_value("0"))              //
+    ("m,methods", "Set the methods", cxxopts::value<std::vector<std::string>>()->default_value("echo"))  //
+    ("payload", "Set the params size", cxxopts::value<size_t>()->default_value("16"))                    //
+    ("attachs", "Set the uploads per call", cxxopts::value<size_t>()->default_value("0"))                //
+    ("attach-size", "Set the upload size", cxxopts::value<size_t>()->default_value("1024"))              //
+    ("o,output", "Write the JSON report to a file", cxxopts::value<std::string>())                       //
+    ("serve", "Measure a server started in process")                                                     //
+    ("threads", "Set the workers of that server", cxxopts::value<size_t>())                              //
+    ;
+
+  try {
+    auto result = options.parse(argc, argv);
+
+    if (result["help"].as<bool>()) {
+      std::cout << options.help() << std::endl;
+      std::exit(0);
+    }
+
+    if (result["version"].as<bool>()) {
+      std::cout << "wsrpc, version " << WSRPC_VERSION << std::endl;
+      std::exit(0);
+    }
+
+    config_t config{
+      .host = result["host"].as<std::string>(),
+      .port = result["port"].as<int>(),
+      .connections = std::max<size_t>(result["connections"].as<size_t>(), 1),
+      .inflight = std::max<size_t>(result["inflight"].as<size_t>(), 1),
+      .calls = result["calls"].as<size_t>(),
+      .duration_secs = result["duration"].as<size_t>(),
+      .methods = result["methods"].as<std::vector<std::string>>(),
+      .payload = result["payload"].as<size_t>(),
+      .attachs = result["attachs"].as<size_t>(),
+      .attach_size = result["attach-size"].as<size_t>(),
+    };
+    return {std::move(config), std::move(result)};
+  }
+  catch (const cxxopts::exceptions::exception& e) {
+    std::cerr << "Error parsing options: " << e.what() << std::endl;
+    std::cerr << std::endl;
+    std::cerr << options.help() << std::endl;
+    std::exit(1);
+  }
+}
+
+int main(const int argc, const char* const argv[])
+{
+  wsrpc::init_logger();
+  spdlog::set_level(spdlog::level::warn);
+
+  auto [config, args] = cli(argc, argv);
+
+  std::jthread server;
+  if (args["serve"].as<bool>()) {
+    wsrpc::Options options{.host = config.host, .port = config.port, .timeout_secs = 1};
+    if (args.count("threads")) options.threads_num = args["threads"].as<size_t>();
+    server = std::jthread([options]() { wsrpc::serve<wsrpc::App>(options); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+
+  std::cerr << fmt::format(
+                 "Running {} connections x {} in flight against ws://{}:{}...",
+                 config.connections,
+                 config.inflight,
+                 config.host,
+                 config.port)
+            << std::endl;
+  std::vector<result_t> results(config.connections);
+  auto start = clock_type::now();
+  {
+    auto until = start + std::chrono::seconds(config.duration_secs);
+    std::vector<std::jthread> threads;
+    for (auto& result : results) threads.emplace_back(drive, std::cref(config), until, std::ref(result));
+  }
+  auto seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+  auto report = summarize(config, results, seconds);
+  std::cerr << fmt::format(
+                 "{} calls in {:.3f}s: {:.0f} calls/s, p50 {:.1f}us, p99 {:.1f}us, p999 {:.1f}us, {} errors",
+                 report.calls,
+                 report.seconds,
+                 report.throughput,
+                 report.latency_us.p50,
+                 report.latency_us.p99,
+                 report.latency_us.p999,
+                 report.errors)
+            << std::endl;
+
+  auto json = glz::write<glz::opts{.prettify = true}>(report).value_or("{}");
+  if (args.count("output")) {
+    std::ofstream(args["output"].as<std::string>()) << json << std::endl;
+  }
+  else {
+    std::cout << json << std::endl;
+  }
+  return report.failures ? 1 : 0;
+}
@@ -22,6 +22,13 @@ auto cli(const int argc, const char* const argv[]) -> wsrpc::Options
     ("h,host", "Set the listening host", cxxopts::value<std::string>()->default_value("0.0.0.0"))  //
     ("p,port", "Set the listening port", cxxopts::value<int>()->default_value("8080"))             //
     ("t,timeout", "Set the timeout before exit", cxxopts::value<size_t>()->default_value("60"))    //
+    ("io-threads", "Set the number of event loops", cxxopts::value<size_t>()->default_value("1"))  //
+    ("shared-apps", "Set the number of apps shared by connections, 0 for one each",
+     cxxopts::value<size_t>()->default_value("0"))  //
+    ("c,compression", "Set the permessage-deflate mode (disabled, shared, dedicated)",
+     cxxopts::value<std::string>()->default_value("disabled"))  //
+    ("metrics-path", "Set the HTTP route of the metrics, empty to disable",
+     cxxopts::value<std::string>()->default_value("/metrics"))  //
     ;
 
   if (argc == 1) {
@@ -44,10 +51,23 @@ auto cli(const int argc, const char* const argv[]) -> wsrpc::Options
 
     spdlog::set_level(spdlog::level::from_str(result["level"].as<std::string>()));
 
+    const auto compression_str = result["compression"].as<std::string>();
+    auto compression = wsrpc::compression_t::DISABLED;
+    if (compression_str == "shared")
+      compression = wsrpc::compression_t::SHARED;
+    else if (compression_str == "dedicated")
+      compression = wsrpc::compression_t::DEDICATED;
+    else if (compression_str != "disabled")
+      throw cxxopts::exceptions::incorrect_argument_type(compression_str);
+
     return {
       .host = result["host"].as<std::string>(),
       .port = result["port"].as<int>(),
-      .timeout_secs = result["timeout"].as<size_t>()};
+      .timeout_secs = result["timeout"].as<size_t>(),
+      .io_threads = result["io-threads"].as<size_t>(),
+      .compression = compression,
+      .shared_apps = result["shared-apps"].as<size_t>(),
+      .metrics_path = result["metrics-path"].as<std::string>()};
   }
   catch (const cxxopts::exceptions::exception& e) {
     std::cerr << "Error parsing options: " << e.what() << std::endl;
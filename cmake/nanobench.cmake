@@ -0,0 +1,11 @@
+include(${CMAKE_CURRENT_LIST_DIR}/CPM.cmake)
+
+# https://github.com/martinus/nanobench
+
+CPMAddPackage(
+  NAME nanobench
+  VERSION 4.3.11
+  URL https://github.com/martinus/nanobench/archive/refs/tags/v4.3.11.zip
+  EXCLUDE_FROM_ALL YES
+  SYSTEM YES
+)
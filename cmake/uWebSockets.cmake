@@ -29,5 +29,15 @@ target_compile_definitions(uSockets PRIVATE
 
 add_library(uWebSockets INTERFACE)
 target_include_directories(uWebSockets SYSTEM INTERFACE ${uWebSockets_SOURCE_DIR}/src)
-target_compile_definitions(uWebSockets INTERFACE UWS_NO_ZLIB)
 target_link_libraries(uWebSockets INTERFACE uSockets)
+
+# permessage-deflate needs zlib, without it compression stays disabled
+if(wsrpc_WITH_ZLIB)
+  find_package(ZLIB)
+endif()
+if(ZLIB_FOUND)
+  message(STATUS "uWebSockets with zlib ${ZLIB_VERSION_STRING}")
+  target_link_libraries(uWebSockets INTERFACE ZLIB::ZLIB)
+else()
+  target_compile_definitions(uWebSockets INTERFACE UWS_NO_ZLIB)
+endif()
@@ -1,11 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <concepts>
 #include <expected>
 #include <flat_map>
 #include <functional>
+#include <memory_resource>
 #include <memory>
-#include <shared_mutex>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <stop_token>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include <spdlog/spdlog.h>
 
@@ -14,24 +24,151 @@
 namespace wsrpc
 {
 
+/* Per request state handed to handlers alongside their params */
+struct context_t
+{
+  /* Binary frames the client uploaded ahead of the request */
+  attachs_t attachs{};
+  /* Stop requested once the client cancels the request or goes away */
+  std::stop_token token{};
+  /* Sends a partial result ahead of the final one, waiting while its client lags behind.
+   * False once nobody is listening any more, or once a partial was dropped, which fails the call. */
+  std::function<bool(package_t&&)> emit = [](package_t&&) { return false; };
+  /* Per connection state from App::make_session, for apps shared between connections */
+  std::shared_ptr<void> session{};
+  /* Scratch memory for plain handlers, released once they return; not thread-safe, not for async ones */
+  std::pmr::memory_resource* arena = std::pmr::get_default_resource();
+};
+
+/* Scheduling class of a method, higher ones are picked first by idle workers */
+enum class priority_t
+{
+  HIGH,
+  NORMAL,
+  LOW,
+};
+
+/* How the server treats a method, beyond calling its handler */
+struct meta_t
+{
+  /* Send responses through permessage-deflate, when the server enables it */
+  bool compress = true;
+  /* Calls running at once over all connections, 0 for no limit.
+   * Calls past it wait for a slot aside, without holding up the calls of other methods behind them. */
+  size_t max_concurrency = 0;
+  priority_t priority = priority_t::NORMAL;
+  /* Calls queued longer than this are answered with an error instead of running, 0 for none */
+  std::chrono::milliseconds deadline{0};
+  /* Same params, same response: the server replays it without calling the handler again.
+   * Calls without uploads only, and no larger than Cache::max_request, which are keyed on the IO thread. */
+  bool cacheable = false;
+  /* How long a cached response stays valid, 0 until evicted */
+  std::chrono::milliseconds ttl{0};
+  /* Bytes of responses the cache of the method holds, split over Cache::shards of them:
+   * a single response above cache_budget / Cache::shards is never kept */
+  size_t cache_budget = 16 * 1024 * 1024;
+  /* Identical calls arriving while one runs wait for it and share its response, errors of the handler included,
+   * for the same calls as cacheable.
+   * Should the first call be refused instead, as when cancelled or expired, the others run on their own. */
+  bool coalesce = false;
+};
+
+namespace detail
+{
+
+/* Parameter and result types of a callable, for non-generic lambdas and plain functions */
+template <class F>
+struct signature : signature<decltype(&F::operator())>
+{
+};
+
+template <class R, class... A>
+struct signature<R (*)(A...)>
+{
+  using result_t = R;
+  using args_t = std::tuple<A...>;
+};
+
+template <class R, class... A>
+struct signature<R (*)(A...) noexcept> : signature<R (*)(A...)>
+{
+};
+
+template <class R, class C, class... A>
+struct signature<R (C::*)(A...)> : signature<R (*)(A...)>
+{
+};
+
+template <class R, class C, class... A>
+struct signature<R (C::*)(A...) const> : signature<R (*)(A...)>
+{
+};
+
+template <class R, class C, class... A>
+struct signature<R (C::*)(A...) noexcept> : signature<R (*)(A...)>
+{
+};
+
+template <class R, class C, class... A>
+struct signature<R (C::*)(A...) const noexcept> : signature<R (*)(A...)>
+{
+};
+
+template <class F>
+concept deducible = std::is_pointer_v<F> || requires { &F::operator(); };
+
+template <class T>
+inline constexpr bool is_expected = false;
+
+template <class T, class E>
+inline constexpr bool is_expected<std::expected<T, E>> = true;
+
+template <class F, size_t I>
+using arg_t = std::tuple_element_t<I, typename signature<F>::args_t>;
+
+template <class F>
+inline constexpr size_t arity = std::tuple_size_v<typename signature<F>::args_t>;
+
+/* (const Params&) or (const Params&, context_t&), Params being anything but raw JSON */
+template <class F>
+concept typed = deducible<F> && requires { typename signature<F>::args_t; } &&
+                (arity<F> == 1 || (arity<F> == 2 && std::same_as<arg_t<F, 1>, context_t&>)) &&
+                !std::same_as<std::remove_cvref_t<arg_t<F, 0>>, rawjson_t> &&
+                !std::same_as<std::remove_cvref_t<arg_t<F, 0>>, rawjson_view_t>;
+
+}  // namespace detail
+
 class App
 {
 public:
   using return_t = std::expected<package_t, std::string>;
-  using handler_t = std::move_only_function<return_t(rawjson_t)>;
+  using handler_t = std::move_only_function<return_t(rawjson_view_t, context_t&)>;
+  using done_t = std::move_only_function<void(return_t)>;
+  /* Returns before finishing and calls done once later, from any thread; params only live until it returns */
+  using async_handler_t = std::move_only_function<void(rawjson_view_t, context_t, done_t)>;
+
+  struct method_t
+  {
+    handler_t handler;
+    meta_t meta;
+    async_handler_t async = {};
+  };
+
+  using registry_t = std::flat_map<std::string, std::shared_ptr<method_t>>;
 
 public:
+  /* Readers load an immutable snapshot, writers copy it and swap in a new one */
   struct
   {
-    std::shared_mutex mutex = {};
-    std::flat_map<std::string, std::shared_ptr<handler_t>> registry = {};
+    std::mutex mutex = {};
+    std::atomic<std::shared_ptr<const registry_t>> registry{std::make_shared<registry_t>()};
   } handlers = {};
 
 public:
   App()
   {
     SPDLOG_INFO("App created");
-    regist("echo", [](const rawjson_t& params) -> return_t { return package_t{params, {}}; });
+    regist("echo", [](rawjson_view_t params) -> return_t { return package_t{rawjson_t(params), {}}; });
   }
 
   virtual ~App()
@@ -39,17 +176,86 @@ public:
     SPDLOG_INFO("App destroyed");
   }
 
+  /* Called once per connection, whatever it returns comes back in context_t::session */
+  virtual std::shared_ptr<void> make_session()
+  {
+    return nullptr;
+  }
+
   App(const App&) = delete;
   App(App&&) = delete;
   App& operator=(const App&) = delete;
   App& operator=(App&&) = delete;
 
-  void regist(const std::string& method, handler_t&& handler)
+  void regist(const std::string& method, handler_t&& handler, const meta_t& meta = {})
   {
     SPDLOG_INFO("Registering method: {}", method);
-    auto& [mutex, registry] = handlers;
-    std::lock_guard lock(mutex);
-    registry.insert_or_assign(method, std::make_shared<handler_t>(std::move(handler)));
+    store(method, std::make_shared<method_t>(std::move(handler), meta));
+  }
+
+  /* Handlers not interested in their context */
+  template <class F>
+  requires(std::invocable<F&, rawjson_view_t>)
+  void regist(const std::string& method, F&& handler, const meta_t& meta = {})
+  {
+    auto wrapped = [handler = std::forward<F>(handler)](rawjson_view_t params, context_t&) mutable -> return_t {
+      return std::invoke(handler, params);
+    };
+    regist(method, std::move(wrapped), meta);
+  }
+
+  /* Handlers taking an owned rawjson_t still work, at the cost of copying params */
+  template <class F>
+  requires(!std::invocable<F&, rawjson_view_t> && std::invocable<F&, rawjson_t>)
+  void regist(const std::string& method, F&& handler, const meta_t& meta = {})
+  {
+    auto wrapped = [handler = std::forward<F>(handler)](rawjson_view_t params, context_t&) mutable -> return_t {
+      return std::invoke(handler, rawjson_t(params));
+    };
+    regist(method, std::move(wrapped), meta);
+  }
+
+  /* Handlers taking their params as a struct and returning one, glaze reads and writes both in a single pass.
+   * Params not matching the struct are answered with Invalid Params without calling the handler. */
+  template <class F>
+  requires(!std::invocable<F&, rawjson_view_t> && !std::invocable<F&, rawjson_t> &&
+           !std::invocable<F&, rawjson_view_t, context_t&> && detail::typed<std::decay_t<F>>)
+  void regist(const std::string& method, F&& handler, const meta_t& meta = {})
+  {
+    using params_t = std::remove_cvref_t<detail::arg_t<std::decay_t<F>, 0>>;
+    auto wrapped = [handler = std::forward<F>(handler)](rawjson_view_t raw, context_t& ctx) mutable -> return_t {
+      params_t params{};
+      if (auto ec = glz::read_json(params, raw)) [[unlikely]]
+        return std::unexpected(error::format(error::INVALID_PARAMS, glz::format_error(ec, raw)));
+      auto call = [&]() -> decltype(auto) {
+        if constexpr (detail::arity<std::decay_t<F>> == 2)
+          return std::invoke(handler, std::move(params), ctx);
+        else
+          return std::invoke(handler, std::move(params));
+      };
+      if constexpr (std::is_void_v<decltype(call())>) {
+        call();
+        return package_t{"null", {}};
+      }
+      else {
+        return result(call());
+      }
+    };
+    regist(method, std::move(wrapped), meta);
+  }
+
+  /* Plain functions of any of the shapes above: regist<&lookup>("lookup") */
+  template <auto Fn>
+  void regist(const std::string& method, const meta_t& meta = {})
+  {
+    regist(method, Fn, meta);
+  }
+
+  /* Handlers waiting on I/O, which do not hold a worker while they wait */
+  void regist_async(const std::string& method, async_handler_t&& handler, const meta_t& meta = {})
+  {
+    SPDLOG_INFO("Registering async method: {}", method);
+    store(method, std::make_shared<method_t>(handler_t{}, meta, std::move(handler)));
   }
 
   void unregist(const std::string& method)
@@ -57,23 +263,43 @@ public:
     SPDLOG_INFO("Unregistering method: {}", method);
     auto& [mutex, registry] = handlers;
     std::lock_guard lock(mutex);
-    registry.erase(method);
+    auto next = std::make_shared<registry_t>(*registry.load());
+    next->erase(method);
+    registry.store(std::move(next));
   }
 
-  return_t handle(const std::string& method, const rawjson_t& params)
+  std::shared_ptr<method_t> find(const std::string& method) const
   {
-    std::shared_ptr<handler_t> handler;
-    {
-      auto& [mutex, registry] = handlers;
-      std::lock_guard lock(mutex);
-      auto func = registry.find(method);
-      if (func == registry.end()) {
-        return std::unexpected(error::format(error::METHOD_UNAVAIABLE, '"' + method + '"'));
-      }
-      handler = func->second;
+    const auto registry = handlers.registry.load(std::memory_order_acquire);
+    auto func = registry->find(method);
+    if (func == registry->end()) return nullptr;
+    return func->second;
+  }
+
+  return_t handle(const std::string& method, rawjson_view_t params, context_t ctx = {})
+  {
+    auto func = find(method);
+    if (!func) {
+      return std::unexpected(error::format(error::METHOD_UNAVAIABLE, '"' + method + '"'));
+    }
+    return invoke(*func, method, params, std::move(ctx));
+  }
+
+  return_t invoke(method_t& func, const std::string& method, rawjson_view_t params, context_t ctx = {})
+  {
+    if (func.async) {
+      /* Blocks the caller until done, the server takes the other overload */
+      std::optional<return_t> result;
+      std::binary_semaphore ready{0};
+      invoke(func, method, params, std::move(ctx), [&](return_t r) {
+        result = std::move(r);
+        ready.release();
+      });
+      ready.acquire();
+      return std::move(result).value();
     }
     try {
-      return std::invoke(*handler, params);
+      return std::invoke(func.handler, params, ctx);
     }
     catch (const std::exception& e) {
       SPDLOG_ERROR("Uncaught Exception: {}", e.what());
@@ -83,6 +309,67 @@ public:
     }
     return std::unexpected(error::format(error::INTERNAL_ERROR, '"' + method + '"'));
   }
+
+  /* Calls done with the result, right away for plain handlers, whenever they finish for async ones */
+  void invoke(method_t& func, const std::string& method, rawjson_view_t params, context_t ctx, done_t&& done)
+  {
+    if (!func.async) {
+      done(invoke(func, method, params, std::move(ctx)));
+      return;
+    }
+    /* Shared, so that a handler throwing after taking done cannot answer twice */
+    struct once_t
+    {
+      done_t done;
+      std::atomic_flag called = {};
+      void operator()(return_t result)
+      {
+        if (!called.test_and_set()) done(std::move(result));
+      }
+    };
+    auto once = std::make_shared<once_t>(std::move(done));
+    try {
+      std::invoke(func.async, params, std::move(ctx), [once](return_t result) { (*once)(std::move(result)); });
+      return;
+    }
+    catch (const std::exception& e) {
+      SPDLOG_ERROR("Uncaught Exception: {}", e.what());
+    }
+    catch (...) {
+      SPDLOG_CRITICAL("Uncaught Exception: Unknown type");
+    }
+    (*once)(std::unexpected(error::format(error::INTERNAL_ERROR, '"' + method + '"')));
+  }
+
+private:
+  /* What typed handlers return, as handlers return it */
+  template <class R>
+  static return_t result(R&& value)
+  {
+    using T = std::remove_cvref_t<R>;
+    if constexpr (std::same_as<T, return_t> || std::same_as<T, package_t>) {
+      return std::forward<R>(value);
+    }
+    else if constexpr (detail::is_expected<T>) {
+      if (!value) return std::unexpected(std::string(value.error()));
+      return result(*std::forward<R>(value));
+    }
+    else {
+      auto json = glz::write_json(value);
+      if (!json) [[unlikely]]
+        return std::unexpected(error::format(error::INVALID_RESPONSE, glz::format_error(json.error())));
+      return package_t{std::move(json).value(), {}};
+    }
+  }
+
+  void store(const std::string& method, std::shared_ptr<method_t>&& func)
+  {
+    auto& [mutex, registry] = handlers;
+    std::lock_guard lock(mutex);
+    auto next = std::make_shared<registry_t>(*registry.load());
+    next->insert_or_assign(method, std::move(func));
+    registry.store(std::move(next));
+  }
 };
 
 }  // namespace wsrpc
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace wsrpc
+{
+
+/* Writing BEVE (https://github.com/beve-org/beve) straight from JSON text, with no DOM in between,
+ * so that integers stay integers and nothing is copied but the bytes written */
+namespace beve
+{
+
+namespace tag
+{
+static constexpr uint8_t null = 0;
+static constexpr uint8_t boolean = 0b000'01'000;
+static constexpr uint8_t string = 2;
+/* With string keys */
+static constexpr uint8_t object = 3;
+static constexpr uint8_t generic_array = 5;
+/* 8 byte numbers: floating point, signed and unsigned */
+static constexpr uint8_t f64 = 0b011'00'001;
+static constexpr uint8_t i64 = 0b011'01'001;
+static constexpr uint8_t u64 = 0b011'10'001;
+static constexpr uint8_t strings = 0b001'11'100;
+}  // namespace tag
+
+template <class T>
+inline void put(std::string& out, T value)
+{
+  if constexpr (std::endian::native == std::endian::big) value = std::byteswap(value);
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, &value, sizeof(T));
+  out.append(bytes, sizeof(T));
+}
+
+/* Counts and lengths take 1, 2, 4 or 8 bytes, the 2 low bits telling which */
+inline void size(std::string& out, uint64_t n)
+{
+  if (n < (uint64_t(1) << 6))
+    put(out, uint8_t(n << 2));
+  else if (n < (uint64_t(1) << 14))
+    put(out, uint16_t(n << 2 | 1));
+  else if (n < (uint64_t(1) << 30))
+    put(out, uint32_t(n << 2 | 2));
+  else
+    put(out, uint64_t(n << 2 | 3));
+}
+
+/* An object key, or an item of a string array, which go without a header */
+inline void text(std::string& out, std::string_view s)
+{
+  size(out, s.size());
+  out += s;
+}
+
+namespace detail
+{
+
+class Transcoder
+{
+public:
+  /* Deep enough for any sane document, shallow enough for the stack */
+  static constexpr size_t max_depth = 512;
+
+  Transcoder(std::string_view json, std::string& out) : it(json.data()), end(json.data() + json.size()), out(out)
+  {
+  }
+
+  bool operator()()
+  {
+    skip();
+    if (!value(0)) return false;
+    skip();
+    return it == end;
+  }
+
+private:
+  void skip()
+  {
+    while (it != end && (*it == ' ' || *it == '\t' || *it == '\n' || *it == '\r')) ++it;
+  }
+
+  bool literal(std::string_view word)
+  {
+    if (size_t(end - it) < word.size() || std::string_view(it, word.size()) != word) return false;
+    it += word.size();
+    return true;
+  }
+
+  bool value(size_t depth)
+  {
+    if (it == end || depth > max_depth) return false;
+    switch (*it) {
+      case 'n':
+        out += char(tag::null);
+        return literal("null");
+      case 't':
+        out += char(tag::boolean | 1 << 4);
+        return literal("true");
+      case 'f':
+        out += char(tag::boolean);
+        return literal("false");
+      case '"':
+        out += char(tag::string);
+        return string();
+      case '[':
+        return array(depth);
+      case '{':
+        return object(depth);
+      default:
+        return number();
+    }
+  }
+
+  /* Containers are counted as they are read, into 4 bytes left for it up front */
+  size_t reserve()
+  {
+    out.append(4, '\0');
+    return out.size() - 4;
+  }
+
+  bool patch(size_t at, size_t count)
+  {
+    if (count >= (size_t(1) << 30)) return false;
+    auto n = uint32_t(count << 2 | 2);
+    if constexpr (std::endian::native == std::endian::big) n = std::byteswap(n);
+    std::memcpy(out.data() + at, &n, sizeof(n));
+    return true;
+  }
+
+  template <class F>
+  bool items(char close, F&& item)
+  {
+    ++it;
+    auto at = reserve();
+    size_t count = 0;
+    skip();
+    if (it != end && *it == close) {
+      ++it;
+      return patch(at, count);
+    }
+    while (true) {
+      skip();
+      if (!item()) return false;
+      ++count;
+      skip();
+      if (it == end) return false;
+      if (*it == ',') {
+        ++it;
+        continue;
+      }
+      if (*it != close) return false;
+      ++it;
+      return patch(at, count);
+    }
+  }
+
+  bool array(size_t depth)
+  {
+    out += char(tag::generic_array);
+    return items(']', [&]() { return value(depth + 1); });
+  }
+
+  bool object(size_t depth)
+  {
+    out += char(tag::object);
+    return items('}', [&]() {
+      if (it == end || *it != '"' || !string()) return false;
+      skip();
+      if (it == end || *it != ':') return false;
+      ++it;
+      skip();
+      return value(depth + 1);
+    });
+  }
+
+  /* Written as is unless escaped, which goes through scratch */
+  bool string()
+  {
+    auto begin = ++it;
+    while (it != end && *it != '"' && *it != '\\') {
+      if (uint8_t(*it) < 0x20) return false;
+      ++it;
+    }
+    if (it == end) return false;
+    if (*it == '"') {
+      text(out, std::string_view(begin, it++));
+      return true;
+    }
+    scratch.assign(begin, it);
+    while (it != end && *it != '"') {
+      if (uint8_t(*it) < 0x20) return false;
+      if (*it != '\\') {
+        scratch += *it++;
+        continue;
+      }
+      if (++it == end) return false;
+      switch (*it++) {
+        case '"': scratch += '"'; break;
+        case '\\': scratch += '\\'; break;
+        case '/': scratch += '/'; break;
+        case 'b': scratch += '\b'; break;
+        case 'f': scratch += '\f'; break;
+        case 'n': scratch += '\n'; break;
+        case 'r': scratch += '\r'; break;
+        case 't': scratch += '\t'; break;
+        case 'u':
+          if (!unicode()) return false;
+          break;
+        default:
+          return false;
+      }
+    }
+    if (it == end) return false;
+    ++it;
+    text(out, scratch);
+    return true;
+  }
+
+  bool hex(uint32_t& code)
+  {
+    if (end - it < 4) return false;
+    auto [ptr, ec] = std::from_chars(it, it + 4, code, 16);
+    if (ec != std::errc{} || ptr != it + 4) return false;
+    it += 4;
+    return true;
+  }
+
+  /* After \u, surrogate pairs joined, as UTF-8 */
+  bool unicode()
+  {
+    uint32_t code = 0;
+    if (!hex(code)) return false;
+    if (code >= 0xD800 && code < 0xDC00) {
+      uint32_t low = 0;
+      if (!literal("\\u") || !hex(low) || low < 0xDC00 || low >= 0xE000) return false;
+      code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+    else if (code >= 0xDC00 && code < 0xE000) {
+      return false;
+    }
+    if (code < 0x80) {
+      scratch += char(code);
+    }
+    else if (code < 0x800) {
+      scratch += char(0xC0 | code >> 6);
+      scratch += char(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000) {
+      scratch += char(0xE0 | code >> 12);
+      scratch += char(0x80 | (code >> 6 & 0x3F));
+      scratch += char(0x80 | (code & 0x3F));
+    }
+    else {
+      scratch += char(0xF0 | code >> 18);
+      scratch += char(0x80 | (code >> 12 & 0x3F));
+      scratch += char(0x80 | (code >> 6 & 0x3F));
+      scratch += char(0x80 | (code & 0x3F));
+    }
+    return true;
+  }
+
+  /* Integers as such, past 64 bits or with a fraction or exponent as doubles */
+  bool number()
+  {
+    auto begin = it;
+    if (it != end && *it == '-') ++it;
+    auto digits = [this]() {
+      auto from = it;
+      while (it != end && *it >= '0' && *it <= '9') ++it;
+      return it != from;
+    };
+    if (it == end || (*it == '0' && it + 1 != end && it[1] >= '0' && it[1] <= '9')) return false;
+    if (!digits()) return false;
+    bool integral = true;
+    if (it != end && *it == '.') {
+      ++it;
+      integral = false;
+      if (!digits()) return false;
+    }
+    if (it != end && (*it == 'e' || *it == 'E')) {
+      ++it;
+      integral = false;
+      if (it != end && (*it == '+' || *it == '-')) ++it;
+      if (!digits()) return false;
+    }
+    if (integral) {
+      if (int64_t i; std::from_chars(begin, it, i).ec == std::errc{}) {
+        out += char(tag::i64);
+        put(out, i);
+        return true;
+      }
+      if (uint64_t u; *begin != '-' && std::from_chars(begin, it, u).ec == std::errc{}) {
+        out += char(tag::u64);
+        put(out, u);
+        return true;
+      }
+    }
+    double d = 0;
+    auto [ptr, ec] = std::from_chars(begin, it, d);
+    if (ptr != it || ec != std::errc{}) return false;
+    out += char(tag::f64);
+    put(out, std::bit_cast<uint64_t>(d));
+    return true;
+  }
+
+private:
+  const char* it;
+  const char* end;
+  std::string& out;
+  std::string scratch{};
+};
+
+}  // namespace detail
+
+/* Appends the JSON value json to out as BEVE, false if it is not valid JSON, leaving out partly written */
+inline bool from_json(std::string_view json, std::string& out)
+{
+  return detail::Transcoder(json, out)();
+}
+
+}  // namespace beve
+
+}  // namespace wsrpc
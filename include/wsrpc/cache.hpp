@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <glaze/glaze.hpp>
+
+#include "wsrpc/message.hpp"
+
+namespace wsrpc
+{
+
+/* Responses of a pure method by params, least recently used ones evicted past a byte budget */
+class Cache
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  /* What a hit replays, ready to be sent but for the request id */
+  struct entry_t
+  {
+    /* The serialized response after its id: "result":...} */
+    rawjson_t tail;
+    attachs_t atts;
+    bool compress = true;
+  };
+
+  /* Lookups lock one shard only, picked by the key hash */
+  static constexpr size_t shards = 16;
+  /* Larger requests are not looked up: keying them would hold up the IO thread longer than running them saves */
+  static constexpr size_t max_request = 16 * 1024;
+
+public:
+  /* ttl of 0 keeps entries until evicted */
+  Cache(size_t budget, std::chrono::milliseconds ttl) : budget(budget / shards), ttl(ttl)
+  {
+  }
+
+  Cache(const Cache&) = delete;
+  Cache& operator=(const Cache&) = delete;
+
+  /* Params equal but for whitespace share a key, nullopt for params that are not JSON */
+  static std::optional<std::string> key(std::string_view method, std::string_view params)
+  {
+    auto minified = glz::minify_json(params);
+    if (!minified) return std::nullopt;
+    std::string key;
+    key.reserve(method.size() + 1 + minified->size());
+    key += method;
+    key += '\0';
+    key += *minified;
+    return key;
+  }
+
+  std::shared_ptr<const entry_t> find(const std::string& key)
+  {
+    auto& shard = pick(key);
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) return nullptr;
+    auto node = it->second;
+    if (ttl.count() && clock::now() > node->expires) {
+      shard.bytes -= node->size;
+      shard.index.erase(it);
+      shard.lru.erase(node);
+      return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, node);
+    return node->entry;
+  }
+
+  void store(const std::string& key, entry_t&& entry)
+  {
+    size_t size = key.size() + entry.tail.size();
+    for (auto& att : entry.atts) size += att.size();
+    if (size > budget) return;
+    auto value = std::make_shared<const entry_t>(std::move(entry));
+    auto expires = clock::now() + ttl;
+    auto& shard = pick(key);
+    std::lock_guard lock(shard.mutex);
+    if (auto it = shard.index.find(key); it != shard.index.end()) {
+      shard.bytes -= it->second->size;
+      auto node = it->second;
+      shard.index.erase(it);
+      shard.lru.erase(node);
+    }
+    shard.lru.push_front({key, std::move(value), size, expires});
+    shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+    shard.bytes += size;
+    while (shard.bytes > budget) {
+      auto& last = shard.lru.back();
+      shard.bytes -= last.size;
+      shard.index.erase(last.key);
+      shard.lru.pop_back();
+    }
+  }
+
+  /* Entries held over all shards */
+  size_t size()
+  {
+    size_t count = 0;
+    for (auto& shard : list) {
+      std::lock_guard lock(shard.mutex);
+      count += shard.lru.size();
+    }
+    return count;
+  }
+
+private:
+  struct node_t
+  {
+    std::string key;
+    std::shared_ptr<const entry_t> entry;
+    size_t size;
+    clock::time_point expires;
+  };
+
+  struct alignas(64) shard_t
+  {
+    std::mutex mutex = {};
+    std::list<node_t> lru = {};
+    /* Keys view into their nodes, which do not move */
+    std::unordered_map<std::string_view, std::list<node_t>::iterator> index = {};
+    size_t bytes = 0;
+  };
+
+  shard_t& pick(const std::string& key)
+  {
+    return list[std::hash<std::string>{}(key) % shards];
+  }
+
+private:
+  /* Per shard */
+  const size_t budget;
+  const std::chrono::milliseconds ttl;
+  std::array<shard_t, shards> list{};
+};
+
+/* Identical calls in flight by key: the first one runs, the others wait on its response */
+class Flights
+{
+public:
+  /* Called with the response of the first call, or nullptr if it gave none */
+  using waiter_t = std::move_only_function<void(const Cache::entry_t*)>;
+
+public:
+  /* Makes a waiter and queues it if a call with key is in flight, otherwise records this one as the first */
+  template <class F>
+  requires(std::is_invocable_r_v<waiter_t, F&>)
+  bool join(const std::string& key, F&& follow)
+  {
+    std::lock_guard lock(mutex);
+    auto [it, first] = list.try_emplace(key);
+    if (first) return false;
+    it->second.push_back(std::invoke(follow));
+    return true;
+  }
+
+  /* Ends the call of key, handing entry to everything that joined it meanwhile */
+  void land(const std::string& key, const Cache::entry_t* entry)
+  {
+    std::vector<waiter_t> waiters;
+    {
+      std::lock_guard lock(mutex);
+      auto node = list.extract(key);
+      if (node.empty()) return;
+      waiters = std::move(node.mapped());
+    }
+    for (auto& waiter : waiters) waiter(entry);
+  }
+
+  size_t size()
+  {
+    std::lock_guard lock(mutex);
+    return list.size();
+  }
+
+private:
+  std::mutex mutex = {};
+  std::unordered_map<std::string, std::vector<waiter_t>> list = {};
+};
+
+}  // namespace wsrpc
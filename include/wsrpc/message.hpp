@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -13,15 +16,81 @@ namespace wsrpc
 {
 
 using rawjson_t = std::string;
+using rawjson_view_t = std::string_view;
 using binary_t = std::vector<std::byte>;
-using attachs_t = std::vector<binary_t>;
+
+/* An immutable attachment, copying it only shares the underlying bytes */
+class attach_t
+{
+public:
+  attach_t() = default;
+
+  attach_t(binary_t&& data) : attach_t(std::make_shared<const binary_t>(std::move(data)))
+  {
+  }
+
+  attach_t(const binary_t& data) : attach_t(std::make_shared<const binary_t>(data))
+  {
+  }
+
+  attach_t(std::shared_ptr<const binary_t> data)
+    : owner(data), bytes(data ? std::span<const std::byte>(*data) : std::span<const std::byte>())
+  {
+  }
+
+  /* Bytes kept alive by any owner, such as a mapped file */
+  attach_t(std::shared_ptr<const void> owner, std::span<const std::byte> bytes)
+    : owner(std::move(owner)), bytes(bytes)
+  {
+  }
+
+  const std::byte* data() const
+  {
+    return bytes.data();
+  }
+
+  size_t size() const
+  {
+    return bytes.size();
+  }
+
+  bool empty() const
+  {
+    return bytes.empty();
+  }
+
+  operator std::span<const std::byte>() const
+  {
+    return bytes;
+  }
+
+  /* Already compressed payloads, such as images, are better sent as is */
+  attach_t& compress(bool enable)
+  {
+    compressible = enable;
+    return *this;
+  }
+
+  bool compress() const
+  {
+    return compressible;
+  }
+
+private:
+  std::shared_ptr<const void> owner{};
+  std::span<const std::byte> bytes{};
+  bool compressible = true;
+};
+
+using attachs_t = std::vector<attach_t>;
 using package_t = std::pair<rawjson_t, attachs_t>;
 
 struct request_t
 {
   std::string id{};
   std::string method{};
-  glz::raw_json params{};
+  glz::raw_json_view params{};
+  std::optional<size_t> attachs{};
   operator bool() const
   {
     return !id.empty() && !method.empty() && !params.str.empty();
@@ -33,6 +102,9 @@ struct response_t
   std::string id{};
   glz::raw_json result{};
   std::optional<std::string> error{};
+  std::optional<size_t> attachs{};
+  /* Set on the chunks a streaming handler emits, the final response goes without */
+  std::optional<bool> partial{};
   operator bool() const
   {
     return !id.empty() && (!result.str.empty() || error.has_value());
@@ -46,11 +118,15 @@ inline auto format(const std::string_view& type, const std::string& msg)
   auto f = fmt::format("{} : {}", type, msg);
   return f;
 }
+static constexpr std::string_view PARSE_ERROR = "Parse Error";
 static constexpr std::string_view INVALID_REQUEST = "Invalid Request";
 static constexpr std::string_view INVALID_RESPONSE = "Invalid Response";
 static constexpr std::string_view METHOD_UNAVAIABLE = "Method Unavaiable";
 static constexpr std::string_view INVALID_PARAMS = "Invalid Params";
 static constexpr std::string_view INTERNAL_ERROR = "Internal Error";
+static constexpr std::string_view SERVER_BUSY = "Server Busy";
+static constexpr std::string_view REQUEST_CANCELLED = "Request Cancelled";
+static constexpr std::string_view DEADLINE_EXCEEDED = "Deadline Exceeded";
 }  // namespace error
 
 }  // namespace wsrpc
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+
+namespace wsrpc
+{
+
+namespace metrics
+{
+
+/* Writers spread over cache line sized cells, so that threads rarely touch the same line */
+static constexpr size_t shards = 16;
+
+inline size_t shard()
+{
+  static std::atomic<size_t> next{0};
+  thread_local const size_t index = next.fetch_add(1, std::memory_order_relaxed) % shards;
+  return index;
+}
+
+/* A method name as a label value, escaped as the text format asks, unknown methods all under one name */
+inline std::string label(std::string_view method)
+{
+  if (method.empty()) return "(unknown)";
+  std::string out;
+  out.reserve(method.size());
+  for (char c : method) {
+    switch (c) {
+      case '\\':
+        out += "\\\\";
+        break;
+      case '"':
+        out += "\\\"";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      default:
+        out += c;
+    }
+  }
+  return out;
+}
+
+}  // namespace metrics
+
+/* A monotonic count, cheap to bump from any thread, summed when read */
+class Counter
+{
+public:
+  void add(uint64_t n = 1)
+  {
+    cells[metrics::shard()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const
+  {
+    uint64_t sum = 0;
+    for (auto& cell : cells) sum += cell.value.load(std::memory_order_relaxed);
+    return sum;
+  }
+
+private:
+  struct alignas(64) cell_t
+  {
+    std::atomic<uint64_t> value{0};
+  };
+  std::array<cell_t, metrics::shards> cells{};
+};
+
+/* Durations counted into fixed buckets, from 10us to 10s */
+class Histogram
+{
+public:
+  static constexpr std::array<uint64_t, 16> bounds_us{
+    10, 50, 100, 250, 500, 1'000, 2'500, 5'000,  //
+    10'000, 25'000, 50'000, 100'000, 250'000, 1'000'000, 2'500'000, 10'000'000};
+
+  struct snapshot_t
+  {
+    /* Cumulative, the last one counting everything */
+    std::array<uint64_t, bounds_us.size() + 1> buckets{};
+    uint64_t count = 0;
+    double sum_secs = 0;
+  };
+
+  void observe(std::chrono::nanoseconds duration)
+  {
+    auto ns = uint64_t(std::max<int64_t>(duration.count(), 0));
+    /* To the nearest microsecond, so that a bound is not missed by a fraction of one */
+    auto bucket = std::ranges::lower_bound(bounds_us, (ns + 500) / 1000) - bounds_us.begin();
+    auto& cell = cells[metrics::shard()];
+    cell.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    cell.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  snapshot_t snapshot() const
+  {
+    snapshot_t snap{};
+    uint64_t sum_ns = 0;
+    for (auto& cell : cells) {
+      for (size_t i = 0; i < snap.buckets.size(); ++i)  //
+        snap.buckets[i] += cell.buckets[i].load(std::memory_order_relaxed);
+      sum_ns += cell.sum_ns.load(std::memory_order_relaxed);
+    }
+    for (size_t i = 1; i < snap.buckets.size(); ++i) snap.buckets[i] += snap.buckets[i - 1];
+    snap.count = snap.buckets.back();
+    snap.sum_secs = sum_ns / 1e9;
+    return snap;
+  }
+
+private:
+  struct alignas(64) cell_t
+  {
+    std::array<std::atomic<uint64_t>, bounds_us.size() + 1> buckets{};
+    std::atomic<uint64_t> sum_ns{0};
+  };
+  std::array<cell_t, metrics::shards> cells{};
+};
+
+/* Everything the server counts, rendered in the Prometheus text format */
+class Metrics
+{
+public:
+  struct method_t
+  {
+    /* From arriving on the loop to starting on a worker */
+    Histogram wait;
+    /* From starting on a worker to the reply being handed back */
+    Histogram exec;
+    /* Of cacheable methods only */
+    Counter hits;
+    Counter misses;
+    /* Calls that waited on an identical one instead of running */
+    Counter coalesced;
+  };
+
+  Counter connections_opened;
+  Counter connections_closed;
+  Counter frames_in;
+  Counter frames_out;
+  Counter bytes_in;
+  Counter bytes_out;
+  Counter attachs_in;
+  Counter attachs_out;
+  Counter backpressured;
+  Counter rejected;
+
+public:
+  /* Readers load an immutable snapshot, the first call of a method copies it and swaps in a new one */
+  std::shared_ptr<method_t> method(const std::string& name)
+  {
+    auto current = methods.list.load(std::memory_order_acquire);
+    if (auto it = current->find(name); it != current->end()) return it->second;
+    std::lock_guard lock(methods.mutex);
+    auto next = std::make_shared<list_t>(*methods.list.load());
+    auto& stats = (*next)[name];
+    if (!stats) stats = std::make_shared<method_t>();
+    auto found = stats;
+    methods.list.store(std::move(next));
+    return found;
+  }
+
+  std::string render() const
+  {
+    std::string out;
+    auto it = std::back_inserter(out);
+    auto counter = [&it](std::string_view name, std::string_view help, uint64_t value) {
+      fmt::format_to(it, "# HELP wsrpc_{0} {1}\n# TYPE wsrpc_{0} counter\nwsrpc_{0} {2}\n", name, help, value);
+    };
+    counter("connections_opened_total", "Connections opened.", connections_opened.value());
+    counter("connections_closed_total", "Connections closed.", connections_closed.value());
+    counter("frames_in_total", "Frames received.", frames_in.value());
+    counter("frames_out_total", "Frames sent.", frames_out.value());
+    counter("bytes_in_total", "Payload bytes received.", bytes_in.value());
+    counter("bytes_out_total", "Payload bytes sent.", bytes_out.value());
+    counter("attachs_in_total", "Attachments uploaded.", attachs_in.value());
+    counter("attachs_out_total", "Attachments sent.", attachs_out.value());
+    counter("backpressured_total", "Times a connection was paused for backpressure.", backpressured.value());
+    counter("rejected_total", "Requests refused while backpressured.", rejected.value());
+    auto opened = connections_opened.value();
+    auto closed = connections_closed.value();
+    fmt::format_to(it,
+                   "# HELP wsrpc_connections Connections open.\n# TYPE wsrpc_connections gauge\nwsrpc_connections {}\n",
+                   opened > closed ? opened - closed : 0);
+
+    auto current = methods.list.load(std::memory_order_acquire);
+    auto histogram = [&](std::string_view name, std::string_view help, Histogram method_t::* member) {
+      fmt::format_to(it, "# HELP wsrpc_{0} {1}\n# TYPE wsrpc_{0} histogram\n", name, help);
+      for (auto& [method, stats] : *current) {
+        auto snap = ((*stats).*member).snapshot();
+        auto label = metrics::label(method);
+        for (size_t i = 0; i < Histogram::bounds_us.size(); ++i)
+          fmt::format_to(it,
+                         "wsrpc_{}_bucket{{method=\"{}\",le=\"{}\"}} {}\n",
+                         name,
+                         label,
+                         Histogram::bounds_us[i] / 1e6,
+                         snap.buckets[i]);
+        fmt::format_to(it, "wsrpc_{}_bucket{{method=\"{}\",le=\"+Inf\"}} {}\n", name, label, snap.count);
+        fmt::format_to(it, "wsrpc_{}_sum{{method=\"{}\"}} {}\n", name, label, snap.sum_secs);
+        fmt::format_to(it, "wsrpc_{}_count{{method=\"{}\"}} {}\n", name, label, snap.count);
+      }
+    };
+    histogram("call_wait_seconds", "Time calls spent queued.", &method_t::wait);
+    histogram("call_exec_seconds", "Time calls spent running.", &method_t::exec);
+
+    auto labelled = [&](std::string_view name, std::string_view help, Counter method_t::* member) {
+      fmt::format_to(it, "# HELP wsrpc_{0} {1}\n# TYPE wsrpc_{0} counter\n", name, help);
+      for (auto& [method, stats] : *current) {
+        auto value = ((*stats).*member).value();
+        if (value == 0) continue;
+        fmt::format_to(it, "wsrpc_{}{{method=\"{}\"}} {}\n", name, metrics::label(method), value);
+      }
+    };
+    labelled("cache_hits_total", "Calls answered from the cache.", &method_t::hits);
+    labelled("cache_misses_total", "Calls of cacheable methods that ran.", &method_t::misses);
+    labelled("coalesced_total", "Calls that shared the response of an identical one.", &method_t::coalesced);
+    return out;
+  }
+
+private:
+  using list_t = std::map<std::string, std::shared_ptr<method_t>>;
+
+  struct
+  {
+    std::mutex mutex = {};
+    std::atomic<std::shared_ptr<const list_t>> list{std::make_shared<list_t>()};
+  } methods = {};
+};
+
+}  // namespace wsrpc
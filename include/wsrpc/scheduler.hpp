@@ -0,0 +1,427 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ranges>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace wsrpc
+{
+
+/* A fixed set of worker threads shared by all connections.
+ * Each connection submits into its own Queue; ready queues are served round-robin,
+ * one task at a time, so a busy connection cannot starve the others.
+ * Tasks go into lanes, lower ones served first, and may be capped by a Gate shared across queues.
+ * A gated task waiting for a slot is set aside on its gate, the tasks behind it in its lane go on meanwhile. */
+class Scheduler
+{
+public:
+  using task_t = std::move_only_function<void()>;
+  /* The gate slot of a running task, taken until the last copy goes, which may outlive the task */
+  using slot_t = std::shared_ptr<void>;
+  using held_task_t = std::move_only_function<void(slot_t)>;
+
+  static constexpr size_t lanes = 3;
+
+  class Queue;
+
+  /* Bounds how many tasks submitted through it run at once, over all queues */
+  class Gate
+  {
+  public:
+    explicit Gate(size_t limit) : limit(limit)
+    {
+    }
+
+  private:
+    friend class Scheduler;
+    size_t limit;
+    size_t running = 0;
+    /* Queues with a task parked on it, once per task, in the order they came */
+    std::deque<std::shared_ptr<Queue>> waiters = {};
+  };
+
+  class Queue
+  {
+  public:
+    explicit Queue(Scheduler& scheduler) : scheduler(scheduler)
+    {
+    }
+
+    Queue(const Queue&) = delete;
+    Queue(Queue&&) = delete;
+    Queue& operator=(const Queue&) = delete;
+    Queue& operator=(Queue&&) = delete;
+
+    void submit(task_t&& task, size_t lane = lanes / 2, std::shared_ptr<Gate> gate = nullptr)
+    {
+      scheduler.submit(*this, {std::move(task), {}, std::move(gate)}, std::min(lane, lanes - 1));
+    }
+
+    /* For tasks finishing later than they return, such as async calls: the slot is theirs to keep */
+    void submit(held_task_t&& task, size_t lane = lanes / 2, std::shared_ptr<Gate> gate = nullptr)
+    {
+      scheduler.submit(*this, {{}, std::move(task), std::move(gate)}, std::min(lane, lanes - 1));
+    }
+
+    /* Drops all tasks not yet started, returns how many were dropped */
+    size_t purge()
+    {
+      return scheduler.purge(*this);
+    }
+
+    /* Blocks until no task of this queue is pending or running */
+    void wait()
+    {
+      scheduler.wait(*this);
+    }
+
+    /* Calls then once no task of this queue is pending or running, right away if none is,
+     * otherwise on the worker finishing the last one */
+    void drained(task_t&& then)
+    {
+      scheduler.drained(*this, std::move(then));
+    }
+
+    /* Holds back tasks not yet started until resumed, running ones finish */
+    void pause()
+    {
+      scheduler.pause(*this);
+    }
+
+    void resume()
+    {
+      scheduler.resume(*this);
+    }
+
+    /* Read without the scheduler lock, cheap enough for every frame */
+    bool paused() const
+    {
+      return suspended.load(std::memory_order_relaxed);
+    }
+
+    /* Tasks pending or running, read without the scheduler lock */
+    size_t size() const
+    {
+      return count.load(std::memory_order_relaxed);
+    }
+
+  private:
+    friend class Scheduler;
+
+    struct job_t
+    {
+      task_t task;
+      held_task_t held;
+      std::shared_ptr<Gate> gate;
+      size_t lane = 0;
+      /* Counted as running on its gate already, handed a slot freed while it was parked */
+      bool reserved = false;
+    };
+
+    size_t pending() const
+    {
+      size_t n = parked.size();
+      for (auto& lane : tasks) n += lane.size();
+      return n;
+    }
+
+    Scheduler& scheduler;
+    std::weak_ptr<Queue> self = {};
+    std::array<std::deque<job_t>, lanes> tasks = {};
+    /* Taken off their lanes to wait for a slot of their gates, in order */
+    std::deque<job_t> parked = {};
+    size_t running = 0;
+    /* Per lane, listed as ready */
+    std::array<bool, lanes> ready = {};
+    /* Written under the scheduler lock, mirrored for readers not taking it */
+    std::atomic<bool> suspended = false;
+    std::atomic<size_t> count = 0;
+    std::condition_variable_any idle = {};
+    task_t on_drained = {};
+  };
+
+public:
+  explicit Scheduler(size_t threads_num)
+  {
+    SPDLOG_INFO("Making scheduler with threads: {}...", threads_num);
+    link->scheduler = this;
+    workers.reserve(threads_num);
+    for (size_t i = 0; i < threads_num; ++i) workers.emplace_back([this](std::stop_token st) { work(st); });
+  }
+
+  ~Scheduler()
+  {
+    SPDLOG_INFO("Stopping scheduler...");
+    for (auto& worker : workers) worker.request_stop();
+    cv.notify_all();
+    workers.clear();
+    {
+      /* Slots still held by async calls no longer have anything to release */
+      std::lock_guard lock(link->mutex);
+      link->scheduler = nullptr;
+    }
+    SPDLOG_INFO("Scheduler stopped");
+  }
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler(Scheduler&&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+  Scheduler& operator=(Scheduler&&) = delete;
+
+  std::shared_ptr<Queue> make_queue()
+  {
+    auto queue = std::make_shared<Queue>(*this);
+    queue->self = queue;
+    return queue;
+  }
+
+  std::shared_ptr<Gate> make_gate(size_t limit)
+  {
+    return std::make_shared<Gate>(std::max<size_t>(limit, 1));
+  }
+
+  size_t threads_num() const
+  {
+    return workers.size();
+  }
+
+private:
+  void submit(Queue& queue, Queue::job_t&& job, size_t lane)
+  {
+    job.lane = lane;
+    {
+      std::lock_guard lock(mutex);
+      queue.count++;
+      queue.tasks[lane].push_back(std::move(job));
+      if (queue.ready[lane] || queue.suspended) return;
+      queue.ready[lane] = true;
+      ready[lane].push_back(queue.self.lock());
+    }
+    cv.notify_one();
+  }
+
+  size_t purge(Queue& queue)
+  {
+    std::array<std::deque<Queue::job_t>, lanes> dropped;
+    std::deque<Queue::job_t> parked;
+    task_t then;
+    size_t n = 0;
+    {
+      std::lock_guard lock(mutex);
+      n = queue.pending();
+      dropped.swap(queue.tasks);
+      parked.swap(queue.parked);
+      /* Their entries on the waiters of their gates are skipped once reached */
+      for (auto& lane : dropped) unreserve(lane);
+      queue.count -= n;
+      if (n != 0 && queue.running == 0) then = std::exchange(queue.on_drained, nullptr);
+    }
+    if (n != 0) queue.idle.notify_all();
+    if (then) then();
+    return n;
+  }
+
+  void pause(Queue& queue)
+  {
+    /* Taken off the ready lists lazily, when a worker comes across it */
+    std::lock_guard lock(mutex);
+    queue.suspended = true;
+  }
+
+  void resume(Queue& queue)
+  {
+    {
+      std::lock_guard lock(mutex);
+      if (!queue.suspended) return;
+      queue.suspended = false;
+      for (size_t lane = 0; lane < lanes; ++lane) {
+        if (queue.ready[lane] || queue.tasks[lane].empty()) continue;
+        queue.ready[lane] = true;
+        ready[lane].push_back(queue.self.lock());
+      }
+    }
+    cv.notify_all();
+  }
+
+  void wait(Queue& queue)
+  {
+    std::unique_lock lock(mutex);
+    queue.idle.wait(lock, [&queue] { return queue.pending() == 0 && queue.running == 0; });
+  }
+
+  void drained(Queue& queue, task_t&& then)
+  {
+    {
+      std::lock_guard lock(mutex);
+      if (queue.pending() != 0 || queue.running != 0) {
+        queue.on_drained = std::move(then);
+        return;
+      }
+    }
+    then();
+  }
+
+  /* Hands the free slots of a gate to the tasks parked on it, back ahead of their lanes, under the lock */
+  void wake(const std::shared_ptr<Gate>& gate)
+  {
+    while (!gate->waiters.empty() && gate->running < gate->limit) {
+      auto waiter = std::move(gate->waiters.front());
+      gate->waiters.pop_front();
+      auto& parked = waiter->parked;
+      auto it = std::ranges::find(parked, gate, &Queue::job_t::gate);
+      /* Purged meanwhile */
+      if (it == parked.end()) continue;
+      if (waiter->suspended) {
+        /* Parked again once resumed, their entries left here are skipped */
+        unpark(*waiter, gate);
+        continue;
+      }
+      auto job = std::move(*it);
+      parked.erase(it);
+      gate->running++;
+      job.reserved = true;
+      auto lane = job.lane;
+      waiter->tasks[lane].push_front(std::move(job));
+      if (!waiter->ready[lane]) {
+        waiter->ready[lane] = true;
+        ready[lane].push_back(std::move(waiter));
+      }
+      cv.notify_one();
+    }
+  }
+
+  /* Puts every task of queue parked on gate back ahead of its lane, in order, under the lock */
+  void unpark(Queue& queue, const std::shared_ptr<Gate>& gate)
+  {
+    std::deque<Queue::job_t> rest;
+    std::vector<Queue::job_t> back;
+    for (auto& job : queue.parked) {
+      if (job.gate == gate)
+        back.push_back(std::move(job));
+      else
+        rest.push_back(std::move(job));
+    }
+    queue.parked.swap(rest);
+    for (auto& job : back | std::views::reverse) queue.tasks[job.lane].push_front(std::move(job));
+  }
+
+  /* Gives back the slots reserved for the tasks ahead of a lane that are not going to run yet, under the lock */
+  void unreserve(std::deque<Queue::job_t>& tasks)
+  {
+    std::vector<std::shared_ptr<Gate>> gates;
+    for (auto it = tasks.begin(); it != tasks.end() && it->reserved; ++it) {
+      it->reserved = false;
+      it->gate->running--;
+      gates.push_back(it->gate);
+    }
+    for (auto& gate : gates) wake(gate);
+  }
+
+  void release(const std::shared_ptr<Gate>& gate)
+  {
+    std::lock_guard lock(mutex);
+    gate->running--;
+    wake(gate);
+  }
+
+  /* Gives back the slot of gate, counted as running already, once the last copy goes,
+   * if the scheduler is still around */
+  slot_t hold(const std::shared_ptr<Gate>& gate)
+  {
+    return slot_t(nullptr, [link = link, gate](void*) {
+      std::lock_guard lock(link->mutex);
+      if (link->scheduler) link->scheduler->release(gate);
+    });
+  }
+
+  void work(std::stop_token st)
+  {
+    std::unique_lock lock(mutex);
+    auto any = [this] { return std::ranges::any_of(ready, [](auto& lane) { return !lane.empty(); }); };
+    while (cv.wait(lock, st, any)) {
+      size_t lane = std::ranges::find_if(ready, [](auto& l) { return !l.empty(); }) - ready.begin();
+      auto queue = std::move(ready[lane].front());
+      ready[lane].pop_front();
+      auto& tasks = queue->tasks[lane];
+      if (tasks.empty() || queue->suspended) {
+        /* purged or paused since it became ready, slots handed to it go on to others meanwhile */
+        queue->ready[lane] = false;
+        unreserve(tasks);
+        continue;
+      }
+      auto job = std::move(tasks.front());
+      tasks.pop_front();
+      if (tasks.empty())
+        queue->ready[lane] = false;
+      else
+        ready[lane].push_back(queue);
+      auto& gate = job.gate;
+      if (gate && !job.reserved) {
+        if (gate->running >= gate->limit) {
+          /* The gate puts it back ahead of its lane once a slot frees up */
+          gate->waiters.push_back(queue);
+          queue->parked.push_back(std::move(job));
+          continue;
+        }
+        gate->running++;
+      }
+      queue->running++;
+      auto slot = gate ? hold(gate) : nullptr;
+      lock.unlock();
+      try {
+        if (job.held)
+          job.held(std::move(slot));
+        else
+          job.task();
+      }
+      catch (const std::exception& e) {
+        SPDLOG_ERROR("Uncaught Exception: {}", e.what());
+      }
+      catch (...) {
+        SPDLOG_CRITICAL("Uncaught Exception: Unknown type");
+      }
+      job = {};
+      slot.reset();
+      lock.lock();
+      queue->count--;
+      if (--queue->running == 0 && queue->pending() == 0) {
+        queue->idle.notify_all();
+        if (auto then = std::exchange(queue->on_drained, nullptr)) {
+          lock.unlock();
+          then();
+          lock.lock();
+        }
+      }
+    }
+  }
+
+private:
+  /* Outlived by slots, so that late releases can tell the scheduler is gone */
+  struct link_t
+  {
+    std::mutex mutex = {};
+    Scheduler* scheduler = nullptr;
+  };
+
+  std::shared_ptr<link_t> link = std::make_shared<link_t>();
+  std::mutex mutex = {};
+  std::condition_variable_any cv = {};
+  std::array<std::deque<std::shared_ptr<Queue>>, lanes> ready = {};
+  std::vector<std::jthread> workers = {};
+};
+
+}  // namespace wsrpc
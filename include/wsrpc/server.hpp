@@ -1,27 +1,63 @@
 #pragma once
 
+#include <algorithm>
 #include <concepts>
+#include <expected>
 #include <functional>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <semaphore>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <fmt/format.h>
 #include <glaze/glaze.hpp>
 #include <spdlog/spdlog.h>
 
 #include "wsrpc/app.hpp"
+#include "wsrpc/beve.hpp"
+#include "wsrpc/cache.hpp"
 #include "wsrpc/message.hpp"
 #include "wsrpc/utility.hpp"
 
 namespace wsrpc
 {
 
+/* permessage-deflate, needs the library built with zlib */
+enum class compression_t
+{
+  DISABLED,
+  SHARED,
+  DEDICATED,
+};
+
 struct Options
 {
   std::string host = "127.0.0.1";
   int port = 8080;
   size_t timeout_secs = 5;
   size_t threads_num = std::clamp((int)std::thread::hardware_concurrency() / 3, 8, 24);
+  /* Event loops listening on the same port (SO_REUSEPORT), each on its own thread */
+  size_t io_threads = 1;
+  compression_t compression = compression_t::DISABLED;
+  /* Replies buffered for a socket before its pending requests are held back and emit waits, 0 for no limit */
+  size_t backpressure_limit = 16 * 1024 * 1024;
+  /* Answers requests arriving while held back with a busy error, instead of queueing them */
+  bool reject_busy = false;
+  /* Requests a socket may have queued, past which new ones get a busy error whatever reject_busy says,
+   * so that a client not reading its replies cannot grow the queue without bound. 0 for no limit. */
+  size_t max_queued = 4096;
+  /* Uploads a socket may hold for its next request, by count and bytes, past which it is closed */
+  size_t max_attachs = 256;
+  size_t max_attachs_bytes = 64 * 1024 * 1024;
+  /* Apps built up front and handed out to connections round-robin, 0 builds one per connection */
+  size_t shared_apps = 0;
+  /* HTTP route serving the counters in the Prometheus text format, empty to turn it off */
+  std::string metrics_path = "/metrics";
 };
 
 class Server
@@ -48,46 +84,367 @@ void serve(const Options& options)
   server(options);
 }
 
-using packet_t = struct
+struct packet_t
 {
   rawjson_t resp;
   attachs_t atts;
+  bool compress = true;
+  bool error = false;
+  /* Answered without running, the response of this call alone */
+  bool refused = false;
 };
 
-inline packet_t process(App& app, std::string_view raw)
+using reply_t = std::move_only_function<void(packet_t&&)>;
+
+/* Length of s written as a JSON string */
+inline size_t quoted_size(std::string_view s)
+{
+  size_t size = 2 + s.size();
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t')
+      size += 1;
+    else if (c < 0x20)
+      size += 5;
+  }
+  return size;
+}
+
+/* Appends s as a JSON string, escaped the way glaze does */
+inline void quote(std::string& out, std::string_view s)
+{
+  static constexpr std::string_view hex = "0123456789abcdef";
+  out += '"';
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\b':
+        out += "\\b";
+        break;
+      case '\f':
+        out += "\\f";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          out += "\\u00";
+          out += hex[c >> 4];
+          out += hex[c & 0xF];
+        }
+        else {
+          out += char(c);
+        }
+    }
+  }
+  out += '"';
+}
+
+/* Writes the envelope straight into one buffer of the exact size, the result is copied in once and never scanned */
+inline packet_t pack(const response_t& resp, attachs_t&& atts = {})
+{
+  assert(resp);
+  const std::string_view result = resp.result.str.empty() ? "null" : resp.result.str;
+  const auto attachs = fmt::format_int(resp.attachs.value_or(0));
+  size_t size = 6 + quoted_size(resp.id) + 10 + result.size() + 1;
+  if (resp.error) size += 9 + quoted_size(*resp.error);
+  if (resp.attachs) size += 11 + attachs.size();
+  if (resp.partial) size += 11 + (*resp.partial ? 4 : 5);
+
+  rawjson_t out;
+  out.reserve(size);
+  out += R"({"id":)";
+  quote(out, resp.id);
+  out += R"(,"result":)";
+  out += result;
+  if (resp.error) {
+    out += R"(,"error":)";
+    quote(out, *resp.error);
+  }
+  if (resp.attachs) {
+    out += R"(,"attachs":)";
+    out.append(attachs.data(), attachs.size());
+  }
+  if (resp.partial) {
+    out += R"(,"partial":)";
+    out += *resp.partial ? "true" : "false";
+  }
+  out += '}';
+  assert(out.size() == size);
+  return {std::move(out), std::move(atts), true, resp.error.has_value()};
+}
+
+/* A chunk emitted ahead of the final response to request id */
+inline packet_t partial(const std::string& id, package_t&& chunk)
+{
+  response_t response{.id = id, .result = std::move(chunk.first), .partial = true};
+  if (!chunk.second.empty()) response.attachs = chunk.second.size();
+  return pack(response, std::move(chunk.second));
+}
+
+/* Hands the packet to then, right away unless the method is async */
+inline void process(App& app, std::string_view raw, context_t ctx, reply_t&& then)
 {
   TIMEIT_(0);
   request_t request{};
   response_t response{.result = "null"};
-  auto pack = [](const response_t& resp, attachs_t&& atts = {}) -> packet_t {
-    assert(resp);
-    auto pr = glz::write_json(resp);
-    if (!pr) [[unlikely]] {
-      auto error_msg = error::format(error::INVALID_RESPONSE, glz::format_error(pr.error()));
-      SPDLOG_ERROR(error_msg);
-      auto parse_error = resp;
-      parse_error.error = error_msg;
-      return {glz::write_json(parse_error).value(), {}};
-    }
-    return {std::move(pr).value(), std::move(atts)};
-  };
   auto pe = glz::read_json(request, raw);
   if (pe || !request) [[unlikely]] {
     if (!request.id.empty()) response.id = request.id;
     auto error_msg = error::format(error::INVALID_REQUEST, pe ? glz::format_error(pe, raw) : "field invalid");
     SPDLOG_ERROR(error_msg);
     response.error = error_msg;
-    return pack(response);
+    then(pack(response));
+    return;
   }
   response.id = request.id;
-  auto result = app.handle(request.method, request.params.str);
-  if (!result) {
-    SPDLOG_ERROR("Error calling {}: {}", raw, result.error());
-    response.error = result.error();
-    return pack(response);
-  }
-  response.result = std::move(result.value().first);
-  return pack(response, std::move(result.value().second));
+  /* Uploads are bound by count, a mismatch means they went to the wrong request */
+  if (auto expected = request.attachs.value_or(0); expected != ctx.attachs.size()) [[unlikely]] {
+    auto error_msg = error::format(error::INVALID_REQUEST,
+                                   fmt::format("{} attachs expected, {} uploaded", expected, ctx.attachs.size()));
+    SPDLOG_ERROR(error_msg);
+    response.error = error_msg;
+    then(pack(response));
+    return;
+  }
+  auto func = app.find(request.method);
+  if (!func) {
+    auto error_msg = error::format(error::METHOD_UNAVAIABLE, '"' + request.method + '"');
+    SPDLOG_ERROR("Error calling {}: {}", raw, error_msg);
+    response.error = error_msg;
+    then(pack(response));
+    return;
+  }
+  /* The arena of this thread backs the scratch of plain handlers, reset once they return */
+  Arena::Scope scope;
+  if (!func->async) ctx.arena = scope.resource();
+  /* raw may be gone by the time an async method finishes */
+  auto done = [response = std::move(response), func, method = request.method, then = std::move(then)](
+                App::return_t result) mutable {
+    if (!result) {
+      SPDLOG_ERROR("Error calling {}: {}", method, result.error());
+      response.error = result.error();
+      then(pack(response));
+      return;
+    }
+    response.result = std::move(result.value().first);
+    if (!result.value().second.empty()) response.attachs = result.value().second.size();
+    auto pkg = pack(response, std::move(result.value().second));
+    pkg.compress = func->meta.compress;
+    then(std::move(pkg));
+  };
+  app.invoke(*func, request.method, request.params.str, std::move(ctx), std::move(done));
+}
+
+/* Blocks until done, for async methods too */
+inline packet_t process(App& app, std::string_view raw, context_t ctx = {})
+{
+  std::optional<packet_t> pkg;
+  std::binary_semaphore ready{0};
+  process(app, raw, std::move(ctx), [&](packet_t&& p) {
+    pkg = std::move(p);
+    ready.release();
+  });
+  ready.acquire();
+  return std::move(pkg).value();
+}
+
+/* Control message asking to cancel a request: {"method": "$/cancel", "params": {"id": "..."}} */
+static constexpr std::string_view CANCEL = "$/cancel";
+
+/* The id a cancel message targets, nullopt for any other message */
+inline std::optional<std::string> cancelled(std::string_view raw)
+{
+  /* Cheap rejection first, every frame passes through here on its loop */
+  if (raw.find(CANCEL) == raw.npos) return std::nullopt;
+  if (glz::get_as_json<std::string, "/method">(raw).value_or("") != CANCEL) return std::nullopt;
+  auto id = glz::get_as_json<std::string, "/params/id">(raw);
+  if (!id) [[unlikely]] {
+    SPDLOG_ERROR(error::format(error::INVALID_REQUEST, "cancel without id"));
+    return std::string{};
+  }
+  return std::move(id).value();
+}
+
+/* A frame holding a JSON array of requests */
+inline bool is_batch(std::string_view raw)
+{
+  auto pos = raw.find_first_not_of(" \t\r\n");
+  return pos != raw.npos && raw[pos] == '[';
+}
+
+/* Splits a batch frame into its requests, each viewing into raw */
+inline std::optional<std::vector<std::string_view>> split(std::string_view raw)
+{
+  std::vector<glz::raw_json_view> items{};
+  auto pe = glz::read_json(items, raw);
+  if (pe) [[unlikely]] {
+    SPDLOG_ERROR(error::format(error::INVALID_REQUEST, glz::format_error(pe, raw)));
+    return std::nullopt;
+  }
+  std::vector<std::string_view> requests{};
+  requests.reserve(items.size());
+  for (auto& item : items) requests.push_back(item.str);
+  return requests;
+}
+
+/* Deals uploaded attachments out to the requests of a batch, in order, by their attachs count */
+inline std::vector<attachs_t> bind(const std::vector<std::string_view>& requests, attachs_t&& attachs)
+{
+  std::vector<attachs_t> slices(requests.size());
+  auto next = attachs.begin();
+  for (size_t i = 0; i < requests.size() && next != attachs.end(); ++i) {
+    auto count = glz::get_as_json<size_t, "/attachs">(requests[i]);
+    if (!count) continue;
+    auto n = std::min<size_t>(*count, attachs.end() - next);
+    slices[i].assign(std::make_move_iterator(next), std::make_move_iterator(next + n));
+    next += n;
+  }
+  if (next != attachs.end()) SPDLOG_WARN("Attachments unbound: {}", attachs.end() - next);
+  return slices;
+}
+
+/* Joins the responses of a batch into one array, attachments follow in the same order */
+inline packet_t merge(std::vector<packet_t>&& pkgs)
+{
+  packet_t batch{};
+  size_t size = 2 + pkgs.size();
+  size_t atts = 0;
+  for (auto& pkg : pkgs) {
+    size += pkg.resp.size();
+    atts += pkg.atts.size();
+  }
+  batch.resp.reserve(size);
+  batch.atts.reserve(atts);
+  batch.resp += '[';
+  for (auto& pkg : pkgs) {
+    if (batch.resp.size() > 1) batch.resp += ',';
+    batch.resp += pkg.resp;
+    batch.compress = batch.compress && pkg.compress;
+    batch.error = batch.error || pkg.error;
+    batch.refused = batch.refused || pkg.refused;
+    std::ranges::move(pkg.atts, std::back_inserter(batch.atts));
+  }
+  batch.resp += ']';
+  return batch;
+}
+
+/* Answers a frame with an error without running it, each request of a batch gets its own */
+inline packet_t refuse(std::string_view raw, std::string_view type, const std::string& msg)
+{
+  auto one = [&](std::string_view request) -> packet_t {
+    response_t response{.id = glz::get_as_json<std::string, "/id">(request).value_or(""), .result = "null"};
+    response.error = error::format(type, msg);
+    /* Not through pack, which insists on an id */
+    return {glz::write_json(response).value_or("null"), {}, true, true, true};
+  };
+  if (!is_batch(raw)) return one(raw);
+  std::vector<packet_t> pkgs;
+  for (auto request : split(raw).value_or(std::vector<std::string_view>{})) pkgs.push_back(one(request));
+  return merge(std::move(pkgs));
+}
+
+/* How a connection frames its messages, negotiated through the websocket subprotocol */
+enum class encoding_t
+{
+  JSON,
+  BEVE,
+};
+
+namespace subprotocol
+{
+static constexpr std::string_view JSON = "wsrpc.json";
+static constexpr std::string_view BEVE = "wsrpc.beve";
+}  // namespace subprotocol
+
+/* Picks the first supported subprotocol its client offered, none means plain JSON */
+inline std::pair<encoding_t, std::string_view> negotiate(std::string_view protocols)
+{
+  for (auto part : protocols | std::views::split(',')) {
+    auto protocol = std::string_view(part.begin(), part.end());
+    while (protocol.starts_with(' ')) protocol.remove_prefix(1);
+    while (protocol.ends_with(' ')) protocol.remove_suffix(1);
+    if (protocol == subprotocol::JSON) return {encoding_t::JSON, subprotocol::JSON};
+    if (protocol == subprotocol::BEVE) return {encoding_t::BEVE, subprotocol::BEVE};
+  }
+  return {encoding_t::JSON, {}};
+}
+
+/* Turns a BEVE request frame into the JSON one process expects, or tells why it cannot */
+inline std::expected<std::string, std::string> from_beve(std::string_view raw)
+{
+  std::string json{};
+  auto pe = glz::beve_to_json(raw, json);
+  if (pe) [[unlikely]] {
+    auto error_msg = glz::format_error(pe);
+    SPDLOG_ERROR(error::format(error::PARSE_ERROR, error_msg));
+    return std::unexpected(std::move(error_msg));
+  }
+  return json;
+}
+
+/* Re-encodes a packet for the binary protocol as one BEVE frame: {"message": resp, "attachs": [bytes...]}.
+ * A response that is not valid JSON is answered with an error instead. */
+inline std::string to_beve(const packet_t& pkg)
+{
+  std::string out{};
+  size_t size = 24 + pkg.resp.size();
+  for (auto& att : pkg.atts) size += 9 + att.size();
+  out.reserve(size);
+  out += char(beve::tag::object);
+  beve::size(out, 2);
+  beve::text(out, "message");
+  if (!beve::from_json(pkg.resp, out)) [[unlikely]] {
+    SPDLOG_ERROR(error::format(error::INVALID_RESPONSE, pkg.resp));
+    return to_beve(refuse(pkg.resp, error::INVALID_RESPONSE, "not JSON"));
+  }
+  beve::text(out, "attachs");
+  out += char(beve::tag::strings);
+  beve::size(out, pkg.atts.size());
+  for (auto& att : pkg.atts) beve::text(out, sv(att));
+  return out;
+}
+
+/* The response to id without its id, to replay it under another */
+inline std::optional<Cache::entry_t> untag(const packet_t& pkg, const std::string& id)
+{
+  /* Written in field order, so that the id leads */
+  std::string head = R"({"id":)";
+  quote(head, id);
+  head += ',';
+  if (!pkg.resp.starts_with(head)) [[unlikely]]
+    return std::nullopt;
+  return Cache::entry_t{pkg.resp.substr(head.size()), pkg.atts, pkg.compress};
+}
+
+/* Same, nullopt for errors which are not worth keeping */
+inline std::optional<Cache::entry_t> memo(const packet_t& pkg, const std::string& id)
+{
+  if (pkg.error) return std::nullopt;
+  return untag(pkg, id);
+}
+
+/* A cached response answering id */
+inline packet_t replay(const std::string& id, const Cache::entry_t& entry)
+{
+  rawjson_t resp;
+  resp.reserve(7 + quoted_size(id) + entry.tail.size());
+  resp += R"({"id":)";
+  quote(resp, id);
+  resp += ',';
+  resp += entry.tail;
+  return {std::move(resp), entry.atts, entry.compress};
 }
 
 }  // namespace wsrpc
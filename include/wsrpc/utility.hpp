@@ -1,17 +1,21 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <exception>
 #include <fstream>
 #include <functional>
+#include <memory_resource>
 #include <mutex>
 #include <source_location>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 #include <fmt/chrono.h>
@@ -66,6 +70,14 @@ inline std::string_view sv(const std::vector<std::byte>& data)
   return std::string_view(reinterpret_cast<const char*>(data.data()), data.size());
 }
 
+inline std::string_view sv(std::span<const std::byte> data)
+{
+  if (data.empty()) {
+    return std::string_view();
+  }
+  return std::string_view(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
 inline std::vector<std::byte> read_bytes(const std::string& filePath)
 {
   // Open file in binary mode at the end
@@ -201,6 +213,109 @@ private:
   std::jthread worker_thread_;
 };
 
+/* Multi-producer single-consumer queue, producers never block */
+template <class T>
+class MpscQueue
+{
+public:
+  MpscQueue() = default;
+
+  ~MpscQueue()
+  {
+    drain([](T&&) {});
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  /* Returns true if the queue was empty, i.e. the consumer needs a wakeup */
+  bool push(T&& value)
+  {
+    auto* node = new Node{std::move(value), head_.load(std::memory_order_relaxed)};
+    while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return node->next == nullptr;
+  }
+
+  /* Takes everything pushed so far and hands it to func in push order */
+  template <class F>
+  size_t drain(F&& func)
+  {
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+    Node* prev = nullptr;
+    while (node) {
+      std::swap(node->next, prev);
+      std::swap(node, prev);
+    }
+    size_t count = 0;
+    for (node = prev; node; count++) {
+      func(std::move(node->value));
+      delete std::exchange(node, node->next);
+    }
+    return count;
+  }
+
+private:
+  struct Node
+  {
+    T value;
+    Node* next;
+  };
+
+  std::atomic<Node*> head_{nullptr};
+};
+
+/* Scratch memory of one thread, handed out in order and dropped all at once by the outermost scope */
+class Arena
+{
+public:
+  /* Kept across scopes, only what grows past it goes back to the heap */
+  static constexpr size_t initial = 64 * 1024;
+
+  class Scope
+  {
+  public:
+    Scope() : arena(local())
+    {
+      arena.depth++;
+    }
+
+    ~Scope()
+    {
+      if (--arena.depth == 0) arena.resource.release();
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    std::pmr::memory_resource* resource() const
+    {
+      return &arena.resource;
+    }
+
+  private:
+    Arena& arena;
+  };
+
+  static Arena& local()
+  {
+    thread_local Arena arena;
+    return arena;
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+private:
+  Arena() = default;
+
+private:
+  std::unique_ptr<std::byte[]> buffer = std::make_unique_for_overwrite<std::byte[]>(initial);
+  std::pmr::monotonic_buffer_resource resource{buffer.get(), initial, std::pmr::new_delete_resource()};
+  size_t depth = 0;
+};
+
+/* Logs how long a scope took, reading no clock at all when its level is filtered out */
 class Timer
 {
 public:
@@ -208,13 +323,15 @@ public:
     std::string_view context,
     spdlog::level::level_enum level = spdlog::level::debug,
     std::source_location location = std::source_location::current())
-    : context_(context), level_(level), location_(location), start_(std::chrono::high_resolution_clock::now())
+    : context_(context), level_(level), location_(location), enabled_(spdlog::should_log(level))
   {
+    if (enabled_) start_ = std::chrono::steady_clock::now();
   }
 
   inline ~Timer()
   {
-    const auto end = std::chrono::high_resolution_clock::now();
+    if (!enabled_) return;
+    const auto end = std::chrono::steady_clock::now();
     const std::chrono::duration<double, std::milli> ms = end - start_;
     const spdlog::source_loc loc{location_.file_name(), static_cast<int>(location_.line()), location_.function_name()};
     spdlog::log(loc, level_, "{} took {:.3f} ms", context_, ms.count());
@@ -227,10 +344,27 @@ private:
   const std::string_view context_;
   const spdlog::level::level_enum level_;
   const std::source_location location_;
-  const std::chrono::time_point<std::chrono::high_resolution_clock> start_;
+  const bool enabled_;
+  std::chrono::steady_clock::time_point start_ = {};
+};
+
+namespace detail
+{
+
+/* Stands in for a Timer whose level is compiled out, nothing is left of it */
+struct NoTimer
+{
+  template <typename... Args>
+  constexpr explicit NoTimer(Args&&...)
+  {
+  }
 };
 
-#define TIMEIT wsrpc::Timer _timeit_timer(__FUNCTION__)
-#define TIMEIT_(_level) wsrpc::Timer _timeit_timer(__FUNCTION__, spdlog::level::level_enum(_level))
+}  // namespace detail
+
+#define TIMEIT_(_level)                                                                                           \
+  [[maybe_unused]] std::conditional_t<(int(_level) >= SPDLOG_ACTIVE_LEVEL), wsrpc::Timer, wsrpc::detail::NoTimer> \
+  _timeit_timer(__FUNCTION__, spdlog::level::level_enum(_level))
+#define TIMEIT TIMEIT_(spdlog::level::debug)
 
 }  // namespace wsrpc
@@ -2,6 +2,8 @@
 
 #include "wsrpc/app.hpp"
 #include "wsrpc/message.hpp"
+#include "wsrpc/metrics.hpp"
+#include "wsrpc/scheduler.hpp"
 #include "wsrpc/server.hpp"
 #include "wsrpc/utility.hpp"
 
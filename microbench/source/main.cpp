@@ -0,0 +1,216 @@
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+#include <glaze/glaze.hpp>
+#include <nanobench.h>
+#include <spdlog/sinks/null_sink.h>
+#include <spdlog/spdlog.h>
+
+#include <wsrpc/wsrpc.h>
+
+namespace nb = ankerl::nanobench;
+
+static const auto path = std::filesystem::path(DATAPATH);
+
+static std::string request(std::string_view method, std::string_view params)
+{
+  return fmt::format(R"({{"id":"1","method":"{}","params":{}}})", method, params);
+}
+
+/* process() end to end, params views in place and echo copies them into the result once */
+static void process(nb::Bench& bench)
+{
+  wsrpc::App app;
+  const auto small = request("echo", R"({"a":1})");
+  const auto medium = request("echo", wsrpc::read_text((path / "latest-commit@pbr-book.json").string()));
+  const auto huge = request("echo", wsrpc::read_text((path / "tree-commit-info@pbr-book.json").string()));
+  const auto unknown = request("unknown", "null");
+
+  const std::vector<std::pair<std::string, const std::string*>> cases{
+    {"small", &small},
+    {"medium", &medium},
+    {"huge", &huge},
+    {"unknown", &unknown},
+  };
+
+  bench.title("process").unit("call").relative(true);
+  for (auto& [name, raw] : cases) {
+    bench.run(fmt::format("process {} ({} bytes)", name, raw->size()), [&app, raw]() {
+      auto pkg = wsrpc::process(app, *raw);
+      nb::doNotOptimizeAway(pkg);
+    });
+  }
+}
+
+/* App::handle while other threads keep looking methods up, up to 24 threads in all */
+static void handle(nb::Bench& bench)
+{
+  wsrpc::App app;
+  for (int i = 0; i < 64; ++i)
+    app.regist(fmt::format("method{}", i), [](wsrpc::rawjson_view_t) -> wsrpc::App::return_t {
+      return wsrpc::package_t{"null", {}};
+    });
+
+  bench.title("App::handle").unit("call").relative(true);
+  for (size_t threads : {0, 1, 3, 7, 15, 23}) {
+    std::atomic<bool> stop{false};
+    std::vector<std::jthread> others;
+    for (size_t i = 0; i < threads; ++i) {
+      others.emplace_back([&app, &stop]() {
+        while (!stop.load(std::memory_order_relaxed)) nb::doNotOptimizeAway(app.handle("method7", "null"));
+      });
+    }
+    bench.run(fmt::format("handle with {} contending threads", threads), [&app]() {
+      auto result = app.handle("method42", "null");
+      nb::doNotOptimizeAway(result);
+    });
+    stop = true;
+  }
+}
+
+/* Handler scratch from the arena of the worker against the heap */
+static void arena(nb::Bench& bench)
+{
+  wsrpc::App app;
+  app.regist("heap", [](wsrpc::rawjson_view_t, wsrpc::context_t&) -> wsrpc::App::return_t {
+    std::vector<std::string> scratch;
+    for (int i = 0; i < 64; ++i) scratch.emplace_back(32, 'x');
+    return wsrpc::package_t{std::to_string(scratch.size()), {}};
+  });
+  app.regist("arena", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> wsrpc::App::return_t {
+    std::pmr::vector<std::pmr::string> scratch(ctx.arena);
+    for (int i = 0; i < 64; ++i) scratch.emplace_back(32, 'x');
+    return wsrpc::package_t{std::to_string(scratch.size()), {}};
+  });
+
+  bench.title("arena").unit("call").relative(true);
+  for (auto method : {"heap", "arena"}) {
+    const auto raw = request(method, "null");
+    bench.run(fmt::format("process with {} scratch", method), [&app, &raw]() {
+      auto pkg = wsrpc::process(app, raw);
+      nb::doNotOptimizeAway(pkg);
+    });
+  }
+}
+
+/* Building responses: error strings and writing the envelope around results */
+static void pack(nb::Bench& bench)
+{
+  const auto huge = wsrpc::read_text((path / "tree-commit-info@pbr-book.json").string());
+
+  bench.title("pack").unit("call").relative(true);
+  bench.run("error::format", []() {
+    auto msg = wsrpc::error::format(wsrpc::error::METHOD_UNAVAIABLE, R"("unknown")");
+    nb::doNotOptimizeAway(msg);
+  });
+  bench.run("pack small result", []() {
+    auto pkg = wsrpc::pack(wsrpc::response_t{.id = "1", .result = R"({"a":1})"});
+    nb::doNotOptimizeAway(pkg);
+  });
+  bench.run("pack error", []() {
+    auto pkg = wsrpc::pack(wsrpc::response_t{.id = "1", .result = "null", .error = "Internal Error : \"method\""});
+    nb::doNotOptimizeAway(pkg);
+  });
+  bench.run(fmt::format("pack huge result ({} bytes)", huge.size()), [&huge]() {
+    auto pkg = wsrpc::pack(wsrpc::response_t{.id = "1", .result = huge});
+    nb::doNotOptimizeAway(pkg);
+  });
+  /* What pack did before writing the envelope itself */
+  bench.run(fmt::format("glz::write_json huge result ({} bytes)", huge.size()), [&huge]() {
+    auto json = glz::write_json(wsrpc::response_t{.id = "1", .result = huge});
+    nb::doNotOptimizeAway(json);
+  });
+}
+
+/* Framing replies before they reach the socket: batches, chunks and the binary protocol */
+static void framing(nb::Bench& bench)
+{
+  wsrpc::App app;
+  std::string batch = "[";
+  for (int i = 0; i < 16; ++i) batch += (i ? "," : "") + request("echo", std::to_string(i));
+  batch += "]";
+  auto small = wsrpc::process(app, request("echo", R"({"a":1})"));
+  auto attached = wsrpc::packet_t{small.resp, {wsrpc::binary_t(64 * 1024)}};
+
+  bench.title("framing").unit("call").relative(true);
+  bench.run("split 16", [&batch]() {
+    auto items = wsrpc::split(batch);
+    nb::doNotOptimizeAway(items);
+  });
+  bench.run("merge 16", [&small]() {
+    auto pkg = wsrpc::merge(std::vector<wsrpc::packet_t>(16, small));
+    nb::doNotOptimizeAway(pkg);
+  });
+  bench.run("partial", []() {
+    auto pkg = wsrpc::partial("1", wsrpc::package_t{R"({"a":1})", {}});
+    nb::doNotOptimizeAway(pkg);
+  });
+  bench.run("refuse", [&batch]() {
+    auto pkg = wsrpc::refuse(batch, wsrpc::error::SERVER_BUSY, "backpressured");
+    nb::doNotOptimizeAway(pkg);
+  });
+  auto entry = wsrpc::memo(small, "1").value();
+  bench.run("replay cached", [&entry]() {
+    auto pkg = wsrpc::replay("2", entry);
+    nb::doNotOptimizeAway(pkg);
+  });
+  bench.run("to_beve small", [&small]() {
+    auto frame = wsrpc::to_beve(small);
+    nb::doNotOptimizeAway(frame);
+  });
+  bench.run("to_beve with 64KiB attachment", [&attached]() {
+    auto frame = wsrpc::to_beve(attached);
+    nb::doNotOptimizeAway(frame);
+  });
+}
+
+/* What a TIMEIT costs a scope, filtered out at runtime and logged to a sink that drops it */
+static void timer(nb::Bench& bench)
+{
+  auto previous = spdlog::default_logger();
+  spdlog::set_default_logger(std::make_shared<spdlog::logger>("null", std::make_shared<spdlog::sinks::null_sink_mt>()));
+
+  bench.title("Timer").unit("scope").relative(true);
+  spdlog::set_level(spdlog::level::info);
+  bench.run("Timer filtered", []() {
+    wsrpc::Timer timer("filtered", spdlog::level::debug);
+    nb::doNotOptimizeAway(timer);
+  });
+  bench.run("Timer logged", []() {
+    wsrpc::Timer timer("logged", spdlog::level::info);
+    nb::doNotOptimizeAway(timer);
+  });
+
+  spdlog::set_default_logger(previous);
+  spdlog::set_level(spdlog::level::off);
+}
+
+int main(const int argc, const char* const argv[])
+{
+  /* Error paths log on every call, keep the console for the tables */
+  spdlog::set_level(spdlog::level::off);
+
+  nb::Bench bench;
+  bench.warmup(100).minEpochIterations(100);
+  process(bench);
+  handle(bench);
+  arena(bench);
+  pack(bench);
+  framing(bench);
+  timer(bench);
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    nb::render(nb::templates::json(), bench, out);
+    std::cerr << "Results written to " << argv[1] << std::endl;
+  }
+  return 0;
+}
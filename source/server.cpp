@@ -4,18 +4,31 @@
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <optional>
 #include <ranges>
+#include <shared_mutex>
+#include <span>
+#include <stop_token>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <App.h>
-#include <BS_thread_pool.hpp>
 #include <fmt/format.h>
 #include <glaze/glaze.hpp>
 #include <spdlog/spdlog.h>
 
 #include "wsrpc/app.hpp"
+#include "wsrpc/cache.hpp"
+#include "wsrpc/metrics.hpp"
+#include "wsrpc/scheduler.hpp"
 #include "wsrpc/utility.hpp"
 
 namespace wsrpc
@@ -36,58 +49,754 @@ public:
 private:
   std::atomic<unsigned int> count{0};
   Server::factory_t& app_factory;
+  std::unique_ptr<Scheduler> scheduler;
+
+  /* Shared by all connections when not empty, handlers must be thread-safe */
+  struct
+  {
+    std::vector<std::shared_ptr<App>> list = {};
+    std::atomic<size_t> next = 0;
+  } apps = {};
+
+  /* Every running event loop, so that shutdown reaches all of them */
+  struct
+  {
+    std::mutex mutex = {};
+    bool stopping = false;
+    size_t listening = 0;
+    std::vector<std::pair<uWS::Loop*, uWS::App*>> list = {};
+  } loops = {};
+
+  struct
+  {
+    std::mutex mutex = {};
+    std::unordered_map<std::string, std::shared_ptr<Scheduler::Gate>> list = {};
+  } gates = {};
+
+  struct
+  {
+    std::mutex mutex = {};
+    std::unordered_map<std::string, std::shared_ptr<Cache>> list = {};
+  } caches = {};
+
+  /* Shared with the replies of calls in flight, which may finish late */
+  std::shared_ptr<Flights> flights = std::make_shared<Flights>();
+
+  Metrics metrics;
+
+  std::mutex idle_mutex;
+  ScheduledTask shutdown{"exit", [this]() { exit(); }};
 
 private:
+  struct SocketData;
+  using socket_t = uWS::WebSocket<false, true, SocketData>;
+
+  struct outbox_t;
+
+  /* Outlives its socket, so that late replies can tell it is gone */
+  struct Peer
+  {
+    std::atomic<socket_t*> ws = nullptr;
+    std::shared_ptr<outbox_t> outbox = nullptr;
+    encoding_t encoding = encoding_t::JSON;
+    /* Buffered bytes above which its queue is paused, until drained below half */
+    size_t watermark = 0;
+    Metrics* metrics = nullptr;
+    /* Handed to every call of the socket */
+    std::shared_ptr<void> session = nullptr;
+    /* Requests queued and running by id, and cancels of queued ones */
+    struct
+    {
+      std::mutex mutex = {};
+      std::unordered_map<std::string, size_t> queued = {};
+      std::unordered_map<std::string, std::stop_source> running = {};
+      std::unordered_set<std::string> cancelled = {};
+    } requests = {};
+    /* Set while above its watermark, streaming handlers wait for it to drain */
+    struct
+    {
+      std::mutex mutex = {};
+      std::condition_variable_any drained = {};
+      bool congested = false;
+    } flow = {};
+  };
+
   /* ws->getUserData returns one of these */
   struct SocketData
   {
-    std::unique_ptr<BS::wdc_thread_pool> pool;
-    std::unique_ptr<App> app;
+    std::shared_ptr<Peer> peer;
+    std::shared_ptr<Scheduler::Queue> queue;
+    std::shared_ptr<App> app;
+    encoding_t encoding = encoding_t::JSON;
+    /* Binary frames waiting for the next request, and their bytes */
+    attachs_t attachs;
+    size_t attachs_bytes = 0;
+  };
+
+  /* A finished packet waiting for its loop to send it */
+  struct completion_t
+  {
+    std::shared_ptr<Peer> peer;
+    packet_t pkg;
+    /* Of the call a partial result belongs to, set if it is dropped */
+    std::shared_ptr<std::atomic<bool>> broken = nullptr;
+  };
+
+  /* Requests of one batch frame, answered together once the last one finishes */
+  struct batch_t
+  {
+    std::string frame;
+    std::vector<packet_t> pkgs;
+    std::atomic<size_t> left;
+  };
+
+  /* A reply only the first of several callers gets to give */
+  struct once_t
+  {
+    std::atomic<bool> given = false;
+    reply_t then;
+
+    void operator()(packet_t&& pkg)
+    {
+      if (!given.exchange(true)) then(std::move(pkg));
+    }
+  };
+
+  /* Ends a call in flight for the identical ones waiting on it, with no response to share if it never replies,
+   * as when its socket closes while it is still queued */
+  struct landing_t
+  {
+    std::shared_ptr<Flights> flights;
+    std::string key;
+    bool landed = false;
+
+    void operator()(const Cache::entry_t* entry)
+    {
+      landed = true;
+      flights->land(key, entry);
+    }
+
+    ~landing_t()
+    {
+      if (!landed) flights->land(key, nullptr);
+    }
+  };
+
+  /* One request on its way to a worker, with what its method asks for */
+  struct call_t
+  {
+    std::shared_ptr<Peer> peer = nullptr;
+    std::shared_ptr<App> app = nullptr;
+    /* Keeps the frame that request views alive */
+    std::shared_ptr<const void> owner = nullptr;
+    std::string_view request = {};
+    std::string id = {};
+    meta_t meta = {};
+    std::shared_ptr<Metrics::method_t> stats = nullptr;
+    std::shared_ptr<Scheduler::Gate> gate = nullptr;
+    std::chrono::steady_clock::time_point since = {};
+  };
+
+  /* Finished packets of the sockets of one loop, shared with late replies so that they find it closed */
+  struct outbox_t
+  {
+    uWS::Loop* loop = nullptr;
+    /* Held shared to post, exclusively to close once the loop stops */
+    std::shared_mutex mutex = {};
+    bool closed = false;
+    MpscQueue<completion_t> completions = {};
   };
 
-  void build(SocketData& sd, size_t threads_num = std::thread::hardware_concurrency())
+  void build(SocketData& sd, socket_t* ws, std::shared_ptr<outbox_t> outbox, const Options& options)
   {
     SPDLOG_INFO("Building data for socket...");
-    SPDLOG_INFO("Making pool with threads: {}...", threads_num);
-    sd.pool = std::make_unique<BS::wdc_thread_pool>(threads_num);
-    SPDLOG_INFO("Making app...");
-    sd.app = app_factory();
+    sd.peer =
+      std::make_shared<Peer>(ws, std::move(outbox), sd.encoding, options.backpressure_limit, &metrics);
+    SPDLOG_INFO("Making queue...");
+    sd.queue = scheduler->make_queue();
+    if (apps.list.empty()) {
+      SPDLOG_INFO("Making app...");
+      sd.app = app_factory();
+    }
+    else {
+      sd.app = apps.list[apps.next++ % apps.list.size()];
+    }
+    sd.peer->session = sd.app->make_session();
   }
 
-  void destroy(SocketData& sd)
+  void destroy(SocketData& sd, const Options& options)
   {
     SPDLOG_INFO("Destroying data for socket...");
-    SPDLOG_DEBUG("Stopping pool with tasks: {}...", sd.pool->get_tasks_total());
-    sd.pool->purge();
-    SPDLOG_DEBUG("Waiting pool with tasks: {}...", sd.pool->get_tasks_total());
-    sd.pool->wait();
-    SPDLOG_INFO("Destroying pool...");
-    sd.pool.reset();
-    SPDLOG_INFO("Destroying app...");
-    sd.app.reset();
+    sd.peer->ws = nullptr;
+    /* Streaming handlers waiting on it find it gone */
+    congest(*sd.peer, false);
+    cancel(*sd.peer);
+    SPDLOG_DEBUG("Stopping queue with tasks: {}...", sd.queue->size());
+    sd.queue->purge();
+    /* Tasks submitted by running ones must not stay parked */
+    sd.queue->resume();
+    /* Finished on the loop once its running tasks are done, rather than holding up the other sockets of the loop */
+    SPDLOG_DEBUG("Draining queue with tasks: {}...", sd.queue->size());
+    auto outbox = sd.peer->outbox;
+    sd.queue->drained([this, &options, outbox, app = std::move(sd.app), peer = std::move(sd.peer)]() mutable {
+      /* The loop may be gone once closed, it cannot close while this holds the lock */
+      std::shared_lock lock(outbox->mutex);
+      if (outbox->closed) return;
+      outbox->loop->defer([this, &options, app = std::move(app), peer = std::move(peer)]() mutable {
+        SPDLOG_INFO("Destroying app...");
+        app.reset();
+        peer.reset();
+        metrics.connections_closed.add();
+        closed(options);
+      });
+    });
+    SPDLOG_INFO("Destroying queue...");
+    sd.queue.reset();
   }
 
-  static void reply(auto* ws, const packet_t& pkg)
+  /* Stops a request by id, or drops it before it starts if still queued.
+   * Stopped unlocked: callbacks on its token run right away and may finish the request, which locks again. */
+  static void cancel(Peer& peer, const std::string& id)
   {
-    for (auto& att : pkg.atts | std::views::reverse)  //
-      ws->send(sv(att), uWS::OpCode::BINARY);
-    ws->send(pkg.resp, uWS::OpCode::TEXT);
+    std::stop_source source(std::nostopstate);
+    {
+      std::lock_guard lock(peer.requests.mutex);
+      if (auto it = peer.requests.running.find(id); it != peer.requests.running.end()) {
+        source = it->second;
+      }
+      /* Finished or unknown ids are not kept, a later request may reuse them */
+      else if (peer.requests.queued.contains(id)) {
+        peer.requests.cancelled.insert(id);
+      }
+    }
+    source.request_stop();
   }
 
-  void serve(const Options& options)
+  /* Takes a request off the queued ones as it leaves its queue, under the requests lock.
+   * False if cancelled meanwhile, of several queued under one id the first to leave is. */
+  static bool dequeue(Peer& peer, const std::string& id)
   {
-    uWS::App u;
-    ScheduledTask shutdown("exit", [&]() {
-      u.getLoop()->defer([&]() {
+    auto it = peer.requests.queued.find(id);
+    if (it != peer.requests.queued.end() && --it->second == 0) peer.requests.queued.erase(it);
+    return !peer.requests.cancelled.erase(id);
+  }
+
+  /* Stops every running request of a socket going away, unlocked as above */
+  static void cancel(Peer& peer)
+  {
+    std::vector<std::stop_source> sources;
+    {
+      std::lock_guard lock(peer.requests.mutex);
+      sources.reserve(peer.requests.running.size());
+      for (auto& [id, source] : peer.requests.running) sources.push_back(source);
+    }
+    for (auto& source : sources) source.request_stop();
+  }
+
+  /* Processes one request, unless cancelled meanwhile, with a token its handler can watch.
+   * then may run after this returns, on whatever thread an async handler finishes on. */
+  static void run(std::shared_ptr<Peer> peer, std::shared_ptr<App> app, std::string_view request,
+                  const std::string& id, attachs_t&& attachs, reply_t&& then)
+  {
+    if (id.empty()) {
+      process(*app, request, {.attachs = std::move(attachs), .session = peer->session}, std::move(then));
+      return;
+    }
+    std::stop_token token;
+    {
+      std::lock_guard lock(peer->requests.mutex);
+      if (!dequeue(*peer, id)) {
+        SPDLOG_DEBUG("Request cancelled before running: {}", id);
+        then(refuse(request, error::REQUEST_CANCELLED, '"' + id + '"'));
+        return;
+      }
+      token = peer->requests.running[id].get_token();
+    }
+    /* The app outlives its socket until the last async reply */
+    /* Of this call, not its id, which a later request may reuse */
+    auto broken = std::make_shared<std::atomic<bool>>(false);
+    auto done = [peer, app, id, broken, then = std::move(then)](packet_t&& pkg) mutable {
+      {
+        std::lock_guard lock(peer->requests.mutex);
+        peer->requests.running.erase(id);
+      }
+      /* Its client missed part of the stream, the final result alone would pass for all of it */
+      if (broken->load()) {
+        pkg = pack({.id = id, .result = "null", .error = error::format(error::SERVER_BUSY, "partial results dropped")});
+        pkg.refused = true;
+      }
+      then(std::move(pkg));
+    };
+    /* Chunks go out through the loop as they come, ahead of the final reply, no faster than its client reads */
+    auto emit = [peer, id, token, broken](package_t&& chunk) {
+      if (!writable(*peer, token) || broken->load()) return false;
+      post(peer, partial(id, std::move(chunk)), broken);
+      return true;
+    };
+    context_t ctx{
+      .attachs = std::move(attachs), .token = std::move(token), .emit = std::move(emit), .session = peer->session};
+    process(*app, request, std::move(ctx), std::move(done));
+  }
+
+  /* Waits while the socket of a streaming call is above its watermark, false once it is gone or the call stopped */
+  static bool writable(Peer& peer, std::stop_token token)
+  {
+    std::unique_lock lock(peer.flow.mutex);
+    peer.flow.drained.wait(lock, token, [&peer] { return !peer.flow.congested || !peer.ws.load(); });
+    return peer.ws.load() && !token.stop_requested();
+  }
+
+  static void congest(Peer& peer, bool congested)
+  {
+    {
+      std::lock_guard lock(peer.flow.mutex);
+      peer.flow.congested = congested;
+    }
+    if (!congested) peer.flow.drained.notify_all();
+  }
+
+  /* False if any frame was dropped past the backpressure limit */
+  static bool reply(socket_t* ws, const packet_t& pkg)
+  {
+    auto& sd = *ws->getUserData();
+    auto& metrics = *sd.peer->metrics;
+    metrics.frames_out.add(1 + (sd.encoding == encoding_t::BEVE ? 0 : pkg.atts.size()));
+    metrics.bytes_out.add(pkg.resp.size());
+    if (sd.encoding == encoding_t::BEVE)
+      return ws->send(pkg.resp, uWS::OpCode::BINARY, pkg.compress) != socket_t::DROPPED;
+    bool sent = true;
+    metrics.attachs_out.add(pkg.atts.size());
+    for (auto& att : pkg.atts | std::views::reverse) {
+      metrics.bytes_out.add(att.size());
+      sent = ws->send(sv(att), uWS::OpCode::BINARY, att.compress()) != socket_t::DROPPED && sent;
+    }
+    return ws->send(pkg.resp, uWS::OpCode::TEXT, pkg.compress) != socket_t::DROPPED && sent;
+  }
+
+  /* Hands a finished packet, or a partial one flagging broken if dropped, to the loop of its socket */
+  static void post(std::shared_ptr<Peer> peer, packet_t&& pkg, std::shared_ptr<std::atomic<bool>> broken = nullptr)
+  {
+    /* Late async replies of a closed socket */
+    if (!peer->ws.load()) return;
+    /* Attachments go inline, one opting out of compression keeps the whole frame uncompressed */
+    if (peer->encoding == encoding_t::BEVE) {
+      bool compress = pkg.compress && std::ranges::all_of(pkg.atts, [](const attach_t& att) { return att.compress(); });
+      pkg = {to_beve(pkg), {}, compress};
+    }
+    auto outbox = peer->outbox;
+    /* The loop may be gone once closed, it cannot close while this holds the lock */
+    std::shared_lock lock(outbox->mutex);
+    if (outbox->closed) return;
+    /* Only the first packet of a batch wakes the loop up */
+    if (outbox->completions.push({std::move(peer), std::move(pkg), std::move(broken)}))
+      outbox->loop->defer([outbox]() { flush(*outbox); });
+  }
+
+  /* One gate per method with a concurrency limit, shared by the apps of all sockets */
+  std::shared_ptr<Scheduler::Gate> gate(const std::string& method, size_t limit)
+  {
+    std::lock_guard lock(gates.mutex);
+    auto& gate = gates.list[method];
+    if (!gate) gate = scheduler->make_gate(limit);
+    return gate;
+  }
+
+  /* One cache per cacheable method, shared by the apps of all sockets */
+  std::shared_ptr<Cache> cache(const std::string& method, const meta_t& meta)
+  {
+    std::lock_guard lock(caches.mutex);
+    auto& cache = caches.list[method];
+    if (!cache) cache = std::make_shared<Cache>(meta.cache_budget, meta.ttl);
+    return cache;
+  }
+
+  /* Queues one request in the lane and behind the gate its method asks for,
+   * unless its response is cached or an identical call is already running */
+  void dispatch(const std::shared_ptr<Scheduler::Queue>& queue, call_t call, attachs_t&& attachs, reply_t&& then)
+  {
+    auto& request = call.request;
+    /* Only the method and id are read here, the request is parsed once it runs */
+    auto method = glz::get_as_json<std::string, "/method">(request).value_or("");
+    call.id = glz::get_as_json<std::string, "/id">(request).value_or("");
+    auto func = call.app->find(method);
+    call.meta = func ? func->meta : meta_t{};
+    const auto& meta = call.meta;
+    call.gate = meta.max_concurrency ? gate(method, meta.max_concurrency) : nullptr;
+    /* Unknown methods share one entry, clients must not grow the registry at will */
+    call.stats = metrics.method(func ? method : "");
+    call.since = std::chrono::steady_clock::now();
+    /* Responses to uploads depend on more than params, large params cost the loop too much to key */
+    request_t parsed{};
+    std::optional<std::string> key;
+    if ((meta.cacheable || meta.coalesce) && attachs.empty() && request.size() <= Cache::max_request &&
+        !glz::read_json(parsed, request) && parsed)
+      key = Cache::key(method, parsed.params.str);
+    auto memory = key && meta.cacheable ? cache(method, meta) : nullptr;
+    if (memory) {
+      if (auto hit = memory->find(*key)) {
+        call.stats->hits.add();
+        then(replay(call.id, *hit));
+        return;
+      }
+      call.stats->misses.add();
+    }
+    if (key && meta.coalesce) {
+      auto follow = [&]() { return follower(queue, call, std::move(then)); };
+      if (flights->join(*key, follow)) {
+        call.stats->coalesced.add();
+        return;
+      }
+      /* Refusals answer this call alone, the others then run on their own, as they do if it is dropped unanswered */
+      auto landing = std::make_unique<landing_t>(flights, *key);
+      then = [landing = std::move(landing), id = call.id, then = std::move(then)](packet_t&& pkg) mutable {
+        auto entry = pkg.resp.empty() || pkg.refused ? std::nullopt : untag(pkg, id);
+        (*landing)(entry ? &*entry : nullptr);
+        then(std::move(pkg));
+      };
+    }
+    /* Stored ahead of landing, so that no identical call slips in between and runs again */
+    if (memory) {
+      then = [memory, key = std::move(*key), id = call.id, then = std::move(then)](
+               packet_t&& pkg) mutable {
+        if (auto entry = memo(pkg, id)) memory->store(key, std::move(*entry));
+        then(std::move(pkg));
+      };
+    }
+    schedule(*queue, std::move(call), std::move(attachs), std::move(then));
+  }
+
+  /* Waits on the response of an identical call in flight, listed as running so that a cancel answers it at once.
+   * Without a response to share, as when the first caller went away, it is queued on its own. */
+  static Flights::waiter_t follower(const std::shared_ptr<Scheduler::Queue>& queue, const call_t& call, reply_t&& then)
+  {
+    const auto& id = call.id;
+    auto reply = std::make_shared<once_t>(false, std::move(then));
+    using on_cancel_t = std::stop_callback<std::move_only_function<void()>>;
+    std::unique_ptr<on_cancel_t> on_cancel;
+    if (!id.empty()) {
+      std::stop_token token;
+      {
+        std::lock_guard lock(call.peer->requests.mutex);
+        token = call.peer->requests.running[id].get_token();
+      }
+      on_cancel = std::make_unique<on_cancel_t>(token, [owner = call.owner, request = call.request, id, reply]() {
+        (*reply)(refuse(request, error::REQUEST_CANCELLED, '"' + id + '"'));
+      });
+    }
+    return [queue = std::weak_ptr(queue), call = call, reply, on_cancel = std::move(on_cancel)](
+             const Cache::entry_t* entry) mutable {
+      const auto& id = call.id;
+      on_cancel.reset();
+      if (!id.empty()) {
+        std::lock_guard lock(call.peer->requests.mutex);
+        call.peer->requests.running.erase(id);
+      }
+      auto owner = queue.lock();
+      if (!owner || !call.peer->ws.load() || reply->given) return;
+      if (entry) {
+        (*reply)(replay(id, *entry));
+        return;
+      }
+      schedule(*owner, std::move(call), {}, [reply](packet_t&& pkg) { (*reply)(std::move(pkg)); });
+    };
+  }
+
+  /* Runs a call on a worker once it gets through its lane and gate, unless cancelled or expired by then */
+  static void schedule(Scheduler::Queue& queue, call_t&& call, attachs_t&& attachs, reply_t&& then)
+  {
+    auto lane = std::to_underlying(call.meta.priority);
+    auto gate = call.gate;
+    if (!call.id.empty()) {
+      std::lock_guard lock(call.peer->requests.mutex);
+      call.peer->requests.queued[call.id]++;
+    }
+    /* The gate slot is given back with the reply, async handlers count until they are done */
+    queue.submit(
+      [call = std::move(call), attachs = std::move(attachs), then = std::move(then)](Scheduler::slot_t slot) mutable {
+        auto& [peer, app, owner, request, id, meta, stats, gate, since] = call;
+        if (!peer->ws.load()) {
+          then({});
+          return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        stats->wait.observe(start - since);
+        if (meta.deadline.count() && start - since > meta.deadline) {
+          SPDLOG_WARN("Request expired in queue: {}", request);
+          if (!id.empty()) {
+            std::lock_guard lock(peer->requests.mutex);
+            dequeue(*peer, id);
+          }
+          then(refuse(request, error::DEADLINE_EXCEEDED, fmt::format("{}ms", meta.deadline.count())));
+          return;
+        }
+        auto timed = [stats = std::move(stats), start, slot = std::move(slot), then = std::move(then)](
+                       packet_t&& pkg) mutable {
+          stats->exec.observe(std::chrono::steady_clock::now() - start);
+          then(std::move(pkg));
+          slot.reset();
+        };
+        run(peer, app, request, id, std::move(attachs), std::move(timed));
+      },
+      lane,
+      std::move(gate));
+  }
+
+  /* The uploads of the request just received */
+  static attachs_t take(SocketData& sd)
+  {
+    sd.attachs_bytes = 0;
+    return std::exchange(sd.attachs, {});
+  }
+
+  void receive(SocketData& sd, std::string&& message, encoding_t encoding)
+  {
+    auto frame = std::make_shared<std::string>(std::move(message));
+    auto answer = [](std::shared_ptr<Peer> peer) -> reply_t {
+      return [peer = std::move(peer)](packet_t&& pkg) mutable {
+        if (!peer->ws.load()) return;
+        SPDLOG_TRACE("Response +{} generated: {}", pkg.atts.size(), pkg.resp);
+        assert(not glz::validate_json(pkg.resp));
+        post(std::move(peer), std::move(pkg));
+      };
+    };
+    /* A plain request is scheduled right away by its method, anything else is unpacked by a worker first */
+    if (encoding == encoding_t::JSON && !is_batch(*frame)) {
+      std::string_view request = *frame;
+      dispatch(sd.queue, {sd.peer, sd.app, std::move(frame), request}, take(sd), answer(sd.peer));
+      return;
+    }
+    sd.queue->submit(
+      [this,
+       peer = sd.peer,
+       queue = std::weak_ptr(sd.queue),
+       app = sd.app,
+       frame = std::move(frame),
+       encoding,
+       answer,
+       attachs = take(sd)]() mutable {
+        /* Kept for followers of coalesced calls, which may queue on it later */
+        auto self = queue.lock();
+        if (!self || !peer->ws.load()) return;
+        if (encoding == encoding_t::BEVE) {
+          auto json = from_beve(*frame);
+          if (!json) {
+            post(std::move(peer), refuse({}, error::PARSE_ERROR, json.error()));
+            return;
+          }
+          *frame = std::move(json).value();
+        }
+        assert(not glz::validate_json(*frame));
+        if (!is_batch(*frame)) {
+          std::string_view request = *frame;
+          dispatch(self, {peer, app, std::move(frame), request}, std::move(attachs), answer(peer));
+          return;
+        }
+        auto batch = std::make_shared<batch_t>(std::move(*frame));
+        auto items = split(batch->frame);
+        if (!items) {
+          post(std::move(peer), process(*app, batch->frame));
+          return;
+        }
+        if (items->empty()) {
+          post(std::move(peer), merge({}));
+          return;
+        }
+        SPDLOG_DEBUG("Batch received: {}", items->size());
+        batch->pkgs.resize(items->size());
+        batch->left = items->size();
+        auto slices = wsrpc::bind(*items, std::move(attachs));
+        /* Requests of a batch spread over the workers like separate frames, the last one to finish replies */
+        for (size_t i = 0; i < items->size(); ++i) {
+          auto done = [peer, batch, i](packet_t&& pkg) mutable {
+            batch->pkgs[i] = std::move(pkg);
+            if (--batch->left != 0 || !peer->ws.load()) return;
+            auto merged = merge(std::move(batch->pkgs));
+            SPDLOG_TRACE("Response +{} generated: {}", merged.atts.size(), merged.resp);
+            assert(not glz::validate_json(merged.resp));
+            post(std::move(peer), std::move(merged));
+          };
+          dispatch(self, {peer, app, batch, (*items)[i]}, std::move(slices[i]), std::move(done));
+        }
+      });
+  }
+
+  /* Sends every finished packet, corking the frames of each socket into one write */
+  static void flush(outbox_t& outbox)
+  {
+    std::vector<completion_t> batch;
+    outbox.completions.drain([&batch](completion_t&& c) { batch.push_back(std::move(c)); });
+    SPDLOG_TRACE("Flushing replies: {}", batch.size());
+    std::ranges::stable_sort(batch, {}, [](const completion_t& c) { return c.peer.get(); });
+    for (auto it = batch.begin(); it != batch.end();) {
+      auto end = std::ranges::find_if(it, batch.end(), [&it](const completion_t& c) { return c.peer != it->peer; });
+      if (auto* ws = it->peer->ws.load()) {
+        ws->cork([&]() {
+          for (auto& c : std::ranges::subrange(it, end)) {
+            if (reply(ws, c.pkg) || !c.broken) continue;
+            SPDLOG_WARN("Partial result dropped, failing its stream");
+            c.broken->store(true);
+          }
+        });
+        throttle(ws);
+      }
+      it = end;
+    }
+  }
+
+  /* Stops pulling the requests of a socket its client does not read fast enough, resumes once drained */
+  static void throttle(socket_t* ws)
+  {
+    auto& sd = *ws->getUserData();
+    auto watermark = sd.peer->watermark;
+    if (watermark == 0) return;
+    auto buffered = ws->getBufferedAmount();
+    if (buffered > watermark && !sd.queue->paused()) {
+      SPDLOG_WARN("Socket backpressured: {} bytes buffered, pausing", buffered);
+      sd.peer->metrics->backpressured.add();
+      sd.queue->pause();
+      congest(*sd.peer, true);
+    }
+    else if (buffered <= watermark / 2 && sd.queue->paused()) {
+      SPDLOG_INFO("Socket drained: {} bytes buffered, resuming", buffered);
+      sd.queue->resume();
+      congest(*sd.peer, false);
+    }
+  }
+
+  /* Handles a cancel message, true if it was one */
+  static bool control(SocketData& sd, std::string_view message)
+  {
+    if (message.find(CANCEL) == message.npos) return false;
+    std::optional<std::string> id;
+    if (sd.encoding == encoding_t::BEVE) {
+      auto json = from_beve(message);
+      if (!json) return false;
+      id = cancelled(*json);
+    }
+    else {
+      id = cancelled(message);
+    }
+    if (!id) return false;
+    SPDLOG_DEBUG("Request cancelling: {}", *id);
+    if (!id->empty()) cancel(*sd.peer, *id);
+    return true;
+  }
+
+  /* Answers a request frame right away with a busy error, rather than queueing more replies */
+  static void reject(socket_t* ws, std::string_view message)
+  {
+    auto& sd = *ws->getUserData();
+    sd.peer->metrics->rejected.add();
+    take(sd);
+    if (sd.encoding == encoding_t::BEVE) {
+      auto json = from_beve(message);
+      auto pkg =
+        json ? refuse(*json, error::SERVER_BUSY, "backpressured") : refuse({}, error::PARSE_ERROR, json.error());
+      reply(ws, {to_beve(pkg), {}, pkg.compress});
+      return;
+    }
+    reply(ws, refuse(message, error::SERVER_BUSY, "backpressured"));
+  }
+
+  void exit()
+  {
+    std::lock_guard lock(loops.mutex);
+    loops.stopping = true;
+    for (auto [loop, u] : loops.list) {
+      loop->defer([u]() {
         SPDLOG_INFO("Exiting...");
-        u.close();
+        u->close();
         SPDLOG_INFO("Exited");
       });
-    });
+    }
+  }
+
+  void opened()
+  {
+    std::lock_guard lock(idle_mutex);
+    count++;
+    shutdown.cancel();
+  }
+
+  void closed(const Options& options)
+  {
+    std::lock_guard lock(idle_mutex);
+    count--;
+    if (count == 0) {
+      SPDLOG_INFO("Exiting in {} seconds...", options.timeout_secs);
+      shutdown.schedule(std::chrono::seconds(options.timeout_secs));
+    }
+  }
+
+  void listened(const Options& options)
+  {
+    {
+      std::lock_guard lock(loops.mutex);
+      if (++loops.listening < std::max<size_t>(options.io_threads, 1)) return;
+    }
+    std::lock_guard lock(idle_mutex);
+    if (count == 0) {
+      SPDLOG_INFO("Exiting in {} seconds...", options.timeout_secs);
+      shutdown.schedule(std::chrono::seconds(options.timeout_secs));
+    }
+  }
+
+  void serve(const Options& options)
+  {
+    scheduler = std::make_unique<Scheduler>(options.threads_num);
+    if (options.shared_apps) {
+      SPDLOG_INFO("Making shared apps: {}...", options.shared_apps);
+      for (size_t i = 0; i < options.shared_apps; ++i) apps.list.emplace_back(app_factory());
+    }
+    const size_t io_threads = std::max<size_t>(options.io_threads, 1);
+    std::vector<std::exception_ptr> errors(io_threads);
+    auto run = [&](size_t index) {
+      try {
+        loop(options);
+      }
+      catch (...) {
+        errors[index] = std::current_exception();
+        exit();
+      }
+    };
+    {
+      SPDLOG_INFO("Starting event loops: {}...", io_threads);
+      std::vector<std::jthread> threads;
+      for (size_t i = 1; i < io_threads; ++i) threads.emplace_back(run, i);
+      run(0);
+    }
+    scheduler.reset();
+    apps.list.clear();
+    for (auto& error : errors)
+      if (error) std::rethrow_exception(error);
+  }
+
+  static uWS::CompressOptions compression(const Options& options)
+  {
+#ifdef UWS_NO_ZLIB
+    if (options.compression != compression_t::DISABLED) SPDLOG_WARN("Compression unavailable without zlib");
+    return uWS::DISABLED;
+#else
+    switch (options.compression) {
+      case compression_t::SHARED:
+        return uWS::SHARED_COMPRESSOR;
+      case compression_t::DEDICATED:
+        return uWS::CompressOptions(uWS::DEDICATED_COMPRESSOR | uWS::DEDICATED_DECOMPRESSOR);
+      case compression_t::DISABLED:
+        break;
+    }
+    return uWS::DISABLED;
+#endif
+  }
+
+  void loop(const Options& options)
+  {
+    uWS::App u;
+    auto outbox = std::make_shared<outbox_t>(u.getLoop());
     u.ws<SocketData>(
       "/*",
       {/* Settings */
-       .compression = uWS::DISABLED,
+       .compression = compression(options),
        .maxPayloadLength = 10 * 1024 * 1024,
        .idleTimeout = 60,
        .maxBackpressure = 100 * 1024 * 1024,
@@ -96,37 +805,67 @@ private:
        .sendPingsAutomatically = true,
 
        /* Handlers */
-       .upgrade = nullptr,
+       .upgrade =
+         [&]([[maybe_unused]] auto* res, auto* req, auto* context) {
+           /* This connection upgrading, pick the protocol its client offered */
+           auto [encoding, protocol] = negotiate(req->getHeader("sec-websocket-protocol"));
+           SPDLOG_DEBUG("Socket upgrading with protocol: {}", protocol);
+           res->template upgrade<SocketData>(
+             {.encoding = encoding},
+             req->getHeader("sec-websocket-key"),
+             protocol,
+             req->getHeader("sec-websocket-extensions"),
+             context);
+         },
        .open =
          [&]([[maybe_unused]] auto* ws) {
            /* This connection opened */
            SPDLOG_INFO("Socket opened");
            SPDLOG_INFO("Remote at {}:{}", ws->getRemoteAddressAsText(), us_socket_remote_port(0, (us_socket_t*)ws));
-           count++;
-           shutdown.cancel();
+           opened();
+           metrics.connections_opened.add();
            auto& sd = *ws->getUserData();
-           build(sd, options.threads_num);
+           build(sd, ws, outbox, options);
          },
        .message =
          [&]([[maybe_unused]] auto* ws, std::string_view message, uWS::OpCode opCode) {
            /* A message received */
            SPDLOG_TRACE("Message received: {}, {}", std::to_string(opCode), message);
            auto& sd = *ws->getUserData();
+           metrics.frames_in.add();
+           metrics.bytes_in.add(message.size());
+           if (opCode == uWS::OpCode::TEXT || sd.encoding == encoding_t::BEVE) {
+             /* Handled on the loop, not queued behind the requests it cancels */
+             if (control(sd, message)) return;
+           }
+           if ((opCode == uWS::OpCode::TEXT || sd.encoding == encoding_t::BEVE) &&
+               ((options.reject_busy && sd.queue->paused()) ||
+                (options.max_queued && sd.queue->size() >= options.max_queued))) {
+             reject(ws, message);
+             return;
+           }
            switch (opCode) {
              case uWS::OpCode::TEXT: {
-               sd.pool->detach_task([&u, ws, message = std::string(message)]() {
-                 if (us_socket_is_closed(0, (us_socket_t*)ws)) return;
-                 auto& sd = *ws->getUserData();
-                 assert(not glz::validate_json(message));
-                 auto pkg = process(*sd.app, message);
-                 SPDLOG_TRACE("Response +{} generated: {}", pkg.atts.size(), pkg.resp);
-                 assert(not glz::validate_json(pkg.resp));
-                 u.getLoop()->defer([ws, pkg = std::move(pkg)]() { reply(ws, pkg); });
-               });
+               /* The frame is only valid in this callback, own it once and view it from there on */
+               receive(sd, std::string(message), encoding_t::JSON);
                break;
              }
              case uWS::OpCode::BINARY: {
-               SPDLOG_ERROR("Binary message received but not supported");
+               if (sd.encoding == encoding_t::BEVE) {
+                 receive(sd, std::string(message), encoding_t::BEVE);
+                 break;
+               }
+               /* Uploaded ahead of the request it belongs to, mirroring replies */
+               if (sd.attachs.size() >= options.max_attachs ||
+                   sd.attachs_bytes + message.size() > options.max_attachs_bytes) {
+                 SPDLOG_WARN("Uploads over the limit: {} held, {} bytes, closing", sd.attachs.size(), sd.attachs_bytes);
+                 ws->end(1009, "Uploads over the limit");
+                 return;
+               }
+               metrics.attachs_in.add();
+               sd.attachs_bytes += message.size();
+               auto bytes = std::as_bytes(std::span(message));
+               sd.attachs.emplace_back(binary_t(bytes.begin(), bytes.end()));
                break;
              }
              default:
@@ -143,6 +882,7 @@ private:
          [&]([[maybe_unused]] auto* ws) {
            /* All sending messages drained */
            SPDLOG_DEBUG("Message drained");
+           throttle(ws);
          },
        .ping =
          [&]([[maybe_unused]] auto* ws, std::string_view message) {
@@ -160,23 +900,45 @@ private:
            SPDLOG_INFO("Socket closed: {}, {}", code, message);
            SPDLOG_INFO("Remote at {}:{}", ws->getRemoteAddressAsText(), us_socket_remote_port(0, (us_socket_t*)ws));
            auto& sd = *ws->getUserData();
-           destroy(sd);
-           count--;
-           if (count == 0) {
-             SPDLOG_INFO("Exiting in {} seconds...", options.timeout_secs);
-             shutdown.schedule(std::chrono::seconds(options.timeout_secs));
-           }
+           destroy(sd, options);
          }});
-    u.listen(options.host, options.port, [&](auto* listen_socket) {
-      if (!listen_socket) {
-        SPDLOG_CRITICAL("Unavailable on {}:{}", options.host, options.port);
-        throw std::runtime_error("Unavailable");
+    if (!options.metrics_path.empty()) {
+      /* Plain GETs, the websocket route only takes upgrades */
+      u.get(options.metrics_path, [this](auto* res, [[maybe_unused]] auto* req) {
+        res->writeHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8")->end(metrics.render());
+      });
+    }
+    {
+      std::lock_guard lock(loops.mutex);
+      if (loops.stopping) return;
+      loops.list.emplace_back(u.getLoop(), &u);
+    }
+    auto unlist = [&]() {
+      {
+        std::lock_guard lock(loops.mutex);
+        std::erase(loops.list, std::pair<uWS::Loop*, uWS::App*>{u.getLoop(), &u});
       }
-      SPDLOG_INFO("Listening on {}:{}", options.host, options.port);
-      SPDLOG_INFO("Exiting in {} seconds...", options.timeout_secs);
-      shutdown.schedule(std::chrono::seconds(options.timeout_secs));
-    });
-    u.run();
+      /* Replies finishing from now on are dropped, those left hold their peers, which hold the outbox */
+      std::unique_lock lock(outbox->mutex);
+      outbox->closed = true;
+      outbox->completions.drain([](completion_t&&) {});
+    };
+    try {
+      u.listen(options.host, options.port, [&](auto* listen_socket) {
+        if (!listen_socket) {
+          SPDLOG_CRITICAL("Unavailable on {}:{}", options.host, options.port);
+          throw std::runtime_error("Unavailable");
+        }
+        SPDLOG_INFO("Listening on {}:{}", options.host, options.port);
+        listened(options);
+      });
+      u.run();
+    }
+    catch (...) {
+      unlist();
+      throw;
+    }
+    unlist();
   }
 };
 
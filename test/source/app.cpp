@@ -1,8 +1,11 @@
 #include <atomic>
 #include <chrono>
+#include <expected>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <semaphore>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -11,31 +14,75 @@
 
 #include <wsrpc/app.hpp>
 
+namespace
+{
+
+struct point_t
+{
+  int x = 0;
+  int y = 0;
+};
+
+struct sum_t
+{
+  int sum = 0;
+};
+
+sum_t add(const point_t& p)
+{
+  return {p.x + p.y};
+}
+
+std::expected<sum_t, std::string> positive(const point_t& p)
+{
+  if (p.x < 0 || p.y < 0) return std::unexpected("negative");
+  return add(p);
+}
+
+}  // namespace
+
 TEST_SUITE("app")
 {
   TEST_CASE("App::handler_t")
   {
-    auto handler1 = [](wsrpc::rawjson_t) -> void { return; };
+    auto handler1 = [](wsrpc::rawjson_view_t, wsrpc::context_t&) -> void { return; };
     static_assert(not std::is_convertible_v<decltype(handler1), wsrpc::App::handler_t>);
 
     auto handler2 = []() -> wsrpc::App::return_t { return {}; };
     static_assert(not std::is_convertible_v<decltype(handler2), wsrpc::App::handler_t>);
 
-    auto handler3 = [](wsrpc::rawjson_t) -> wsrpc::App::return_t { return {}; };
+    auto handler3 = [](wsrpc::rawjson_view_t, wsrpc::context_t&) -> wsrpc::App::return_t { return {}; };
     static_assert(std::is_convertible_v<decltype(handler3), wsrpc::App::handler_t>);
 
-    auto handler4 = [](const wsrpc::rawjson_t) -> wsrpc::App::return_t { return {}; };
+    auto handler4 = [](const wsrpc::rawjson_view_t, const wsrpc::context_t&) -> wsrpc::App::return_t { return {}; };
     static_assert(std::is_convertible_v<decltype(handler4), wsrpc::App::handler_t>);
 
-    auto handler5 = [](const wsrpc::rawjson_t&) -> wsrpc::App::return_t { return {}; };
+    auto handler5 = [](const wsrpc::rawjson_view_t&, wsrpc::context_t) -> wsrpc::App::return_t { return {}; };
     static_assert(std::is_convertible_v<decltype(handler5), wsrpc::App::handler_t>);
 
-    auto handler6 = [](wsrpc::rawjson_t&) -> wsrpc::App::return_t { return {}; };
+    auto handler6 = [](wsrpc::rawjson_view_t&, wsrpc::context_t&) -> wsrpc::App::return_t { return {}; };
     static_assert(not std::is_convertible_v<decltype(handler6), wsrpc::App::handler_t>);
 
-    auto handler7 = [p = std::make_unique<int>()](const wsrpc::rawjson_t&) -> wsrpc::App::return_t { return {}; };
+    auto handler7 = [p = std::make_unique<int>()](wsrpc::rawjson_view_t, wsrpc::context_t&) -> wsrpc::App::return_t {
+      return {};
+    };
     static_assert(not std::is_copy_constructible_v<decltype(handler7)>);
     static_assert(std::is_convertible_v<decltype(handler7), wsrpc::App::handler_t>);
+
+    // Handlers without context are adapted by regist
+    auto handler8 = [](wsrpc::rawjson_view_t) -> wsrpc::App::return_t { return {}; };
+    static_assert(not std::is_convertible_v<decltype(handler8), wsrpc::App::handler_t>);
+    static_assert(requires(wsrpc::App& app) { app.regist("", std::move(handler8)); });
+
+    // Handlers taking an owned rawjson_t are adapted by regist
+    auto handler9 = [](const wsrpc::rawjson_t&) -> wsrpc::App::return_t { return {}; };
+    static_assert(not std::is_convertible_v<decltype(handler9), wsrpc::App::handler_t>);
+    static_assert(requires(wsrpc::App& app) { app.regist("", std::move(handler9)); });
+
+    // Handlers taking a struct are adapted by regist, glaze reading params into it
+    auto handler10 = [](const point_t&) -> sum_t { return {}; };
+    static_assert(not std::is_convertible_v<decltype(handler10), wsrpc::App::handler_t>);
+    static_assert(requires(wsrpc::App& app) { app.regist("", std::move(handler10)); });
   }
 
   TEST_CASE("App construction")
@@ -43,8 +90,24 @@ TEST_SUITE("app")
     wsrpc::App app;
 
     // Test that app is constructed with default handlers
-    REQUIRE(app.handlers.registry.size() == 1);
-    CHECK(app.handlers.registry.contains("echo"));
+    REQUIRE(app.handlers.registry.load()->size() == 1);
+    CHECK(app.handlers.registry.load()->contains("echo"));
+  }
+
+  TEST_CASE("App session")
+  {
+    wsrpc::App app;
+    CHECK(app.make_session() == nullptr);
+
+    // Handlers find the session of their connection in the context
+    app.regist("session_method", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> wsrpc::App::return_t {
+      auto count = std::static_pointer_cast<int>(ctx.session);
+      return wsrpc::package_t{std::to_string(++*count), {}};
+    });
+    auto session = std::make_shared<int>(0);
+    CHECK(app.handle("session_method", "{}", {.session = session}).value().first == "1");
+    CHECK(app.handle("session_method", "{}", {.session = session}).value().first == "2");
+    CHECK(*session == 2);
   }
 
   TEST_CASE("App registration and unregistration")
@@ -57,8 +120,8 @@ TEST_SUITE("app")
       return package;
     });
 
-    CHECK(app.handlers.registry.size() == 2);
-    CHECK(app.handlers.registry.contains("test_method"));
+    CHECK(app.handlers.registry.load()->size() == 2);
+    CHECK(app.handlers.registry.load()->contains("test_method"));
 
     // Test registering another handler for the same method (should replace)
     app.regist("test_method", [](const wsrpc::rawjson_t&) -> wsrpc::App::return_t {
@@ -66,11 +129,11 @@ TEST_SUITE("app")
       return package;
     });
 
-    CHECK(app.handlers.registry.size() == 2);
+    CHECK(app.handlers.registry.load()->size() == 2);
 
     // Test unregistering a handler
     app.unregist("test_method");
-    CHECK(app.handlers.registry.size() == 1);
+    CHECK(app.handlers.registry.load()->size() == 1);
   }
 
   TEST_CASE("App handle method")
@@ -103,6 +166,102 @@ TEST_SUITE("app")
     CHECK(result3.error() == "Internal Error : \"throwing_method\"");
   }
 
+  TEST_CASE("App typed handler")
+  {
+    wsrpc::App app;
+    app.regist("add", [](const point_t& p) -> sum_t { return add(p); });
+    app.regist("ctx", [](point_t p, wsrpc::context_t& ctx) { return p.x == 1 && ctx.session == nullptr; });
+    app.regist("none", [](const point_t&) {});
+    app.regist<&add>("add_fn");
+    app.regist<&positive>("positive");
+
+    // Params read into the struct, the result written from it
+    CHECK(app.handle("add", R"({"x":1,"y":2})").value().first == R"({"sum":3})");
+    CHECK(app.handle("add_fn", R"({"x":1,"y":2})").value().first == R"({"sum":3})");
+    CHECK(app.handle("ctx", R"({"x":1})").value().first == "true");
+    CHECK(app.handle("none", "{}").value().first == "null");
+    CHECK(app.handle("positive", R"({"x":1,"y":2})").value().first == R"({"sum":3})");
+    CHECK(app.handle("positive", R"({"x":-1,"y":2})").error() == "negative");
+
+    // Params not matching the struct never reach the handler
+    auto mistyped = app.handle("add", R"({"x":"1"})");
+    REQUIRE_FALSE(mistyped);
+    CHECK(mistyped.error().starts_with("Invalid Params : "));
+    auto unknown = app.handle("add", R"({"z":1})");
+    REQUIRE_FALSE(unknown);
+    CHECK(unknown.error().starts_with("Invalid Params : "));
+  }
+
+  TEST_CASE("App async handler" * doctest::timeout(5.0))
+  {
+    wsrpc::App app;
+
+    // Register a handler finishing on another thread
+    app.regist_async("async_method", [](wsrpc::rawjson_view_t params, wsrpc::context_t, wsrpc::App::done_t done) {
+      std::thread([params = wsrpc::rawjson_t(params), done = std::move(done)]() mutable {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        done(wsrpc::package_t{params, {}});
+      }).detach();
+    });
+    REQUIRE(app.find("async_method"));
+    CHECK(app.find("async_method")->async);
+
+    // Test the completion form
+    std::atomic<bool> called{false};
+    wsrpc::App::return_t result;
+    std::binary_semaphore ready{0};
+    app.invoke(*app.find("async_method"), "async_method", "[1]", {}, [&](wsrpc::App::return_t r) {
+      result = std::move(r);
+      called = true;
+      ready.release();
+    });
+    ready.acquire();
+    CHECK(called.load());
+    REQUIRE(result.has_value());
+    CHECK(result.value().first == "[1]");
+
+    // Test the blocking form waits for it
+    auto result2 = app.handle("async_method", "[2]");
+    REQUIRE(result2.has_value());
+    CHECK(result2.value().first == "[2]");
+
+    // Test a handler throwing before finishing
+    app.regist_async("throwing_method", [](wsrpc::rawjson_view_t, wsrpc::context_t, wsrpc::App::done_t) {
+      throw std::runtime_error("Test exception");
+    });
+    auto result3 = app.handle("throwing_method", "{}");
+    REQUIRE_FALSE(result3.has_value());
+    CHECK(result3.error() == "Internal Error : \"throwing_method\"");
+  }
+
+  TEST_CASE("App streaming handler")
+  {
+    wsrpc::App app;
+
+    // Register a handler emitting chunks ahead of its result
+    app.regist("stream_method", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> wsrpc::App::return_t {
+      size_t sent = 0;
+      for (int i = 0; i < 3; ++i) sent += ctx.emit(wsrpc::package_t{std::to_string(i), {}});
+      return wsrpc::package_t{std::to_string(sent), {}};
+    });
+
+    // Nobody listens to the chunks outside a server
+    auto result = app.handle("stream_method", "{}");
+    REQUIRE(result.has_value());
+    CHECK(result.value().first == "0");
+
+    // Test a context collecting them
+    std::vector<wsrpc::rawjson_t> chunks;
+    wsrpc::context_t ctx{.emit = [&chunks](wsrpc::package_t&& chunk) {
+      chunks.push_back(std::move(chunk.first));
+      return true;
+    }};
+    auto result2 = app.handle("stream_method", "{}", std::move(ctx));
+    REQUIRE(result2.has_value());
+    CHECK(result2.value().first == "3");
+    CHECK(chunks == std::vector<wsrpc::rawjson_t>{"0", "1", "2"});
+  }
+
   TEST_CASE("App thread safety" * doctest::timeout(10.0))
   {
     const auto _spdlog_guard_ = [](auto l) {
@@ -238,4 +397,65 @@ TEST_SUITE("app")
     // Verify that all calls were successful
     CHECK(success_count.load() == num_threads * operations_per_thread);
   }
-}
\ No newline at end of file
+
+  TEST_CASE("App handle lookup under contention" * doctest::timeout(10.0))
+  {
+    const auto _spdlog_guard_ = [](auto l) {
+      auto _l = spdlog::get_level();
+      auto _f = [_l](int*) { spdlog::set_level(_l); };
+      spdlog::set_level(l);
+      return std::unique_ptr<int, decltype(_f)>((int*)&_f, _f);
+    }(spdlog::level::warn);
+
+    wsrpc::App app;
+    for (int i = 0; i < 16; ++i) {
+      app.regist("method_" + std::to_string(i), [i](const wsrpc::rawjson_t&) -> wsrpc::App::return_t {
+        return wsrpc::package_t{std::to_string(i), {}};
+      });
+    }
+
+    const int num_threads = 8;
+    const int operations_per_thread = 1000;
+    std::atomic<bool> stop{false};
+    std::atomic<int> success_count{0};
+    std::atomic<int> churn_found{0};
+    std::atomic<int> churn_missing{0};
+
+    // Methods come and go while the readers look them up
+    std::thread writer([&app, &stop]() {
+      for (int n = 0; !stop.load(); ++n) {
+        const auto name = "churn_" + std::to_string(n % 4);
+        app.regist(name, [](const wsrpc::rawjson_t&) -> wsrpc::App::return_t { return wsrpc::package_t{"-1", {}}; });
+        app.unregist(name);
+      }
+    });
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t]() {
+        for (int i = 0; i < operations_per_thread; ++i) {
+          const int n = (t + i) % 16;
+          auto stable = app.handle("method_" + std::to_string(n), "{}");
+          if (stable && stable->first == std::to_string(n)) success_count++;
+
+          auto churn = app.handle("churn_" + std::to_string(i % 4), "{}");
+          if (churn && churn->first == "-1")
+            churn_found++;
+          else if (!churn && churn.error().find(wsrpc::error::METHOD_UNAVAIABLE) != std::string::npos)
+            churn_missing++;
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    stop = true;
+    writer.join();
+
+    // Registered methods are always found and answer with their own handler
+    CHECK(success_count.load() == num_threads * operations_per_thread);
+    // The others are either found whole or missing, never anything in between
+    CHECK(churn_found.load() + churn_missing.load() == num_threads * operations_per_thread);
+    CHECK(app.find("churn_0") == nullptr);
+  }
+}
@@ -0,0 +1,45 @@
+#include <string>
+
+#include <doctest/doctest.h>
+#include <glaze/glaze.hpp>
+
+#include <wsrpc/beve.hpp>
+
+TEST_SUITE("beve")
+{
+  TEST_CASE("BEVE from JSON")
+  {
+    // Integers stay integers, even those a double cannot hold
+    std::string beve;
+    REQUIRE(wsrpc::beve::from_json(
+      R"({"a": [1, -2, 9007199254740993, 18446744073709551615, 2.5, true, false, null], "b": {}, "c": []})", beve));
+    std::string json;
+    REQUIRE_FALSE(glz::beve_to_json(beve, json));
+    CHECK(json == R"({"a":[1,-2,9007199254740993,18446744073709551615,2.5,true,false,null],"b":{},"c":[]})");
+
+    // Escapes are decoded, surrogate pairs joined
+    beve.clear();
+    REQUIRE(wsrpc::beve::from_json(R"(["x\"y\\z", "é😀"])", beve));
+    json.clear();
+    REQUIRE_FALSE(glz::beve_to_json(beve, json));
+    CHECK(json == "[\"x\\\"y\\\\z\",\"\xc3\xa9\xf0\x9f\x98\x80\"]");
+
+    // Counts past a byte
+    beve.clear();
+    std::string many = "[0";
+    for (int i = 1; i < 1000; ++i) many += ",0";
+    many += ']';
+    REQUIRE(wsrpc::beve::from_json(many, beve));
+    json.clear();
+    REQUIRE_FALSE(glz::beve_to_json(beve, json));
+    CHECK(json == many);
+  }
+
+  TEST_CASE("BEVE from invalid JSON")
+  {
+    for (auto bad : {"", "[1,]", R"({"a"})", "01", "-", R"("\x")", "[1 2]", "tru", R"({"a":1,})", "1 2", "1e400"}) {
+      std::string beve;
+      CHECK_FALSE(wsrpc::beve::from_json(bad, beve));
+    }
+  }
+}
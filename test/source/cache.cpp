@@ -0,0 +1,94 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <wsrpc/cache.hpp>
+
+TEST_SUITE("cache")
+{
+  TEST_CASE("Cache find and store")
+  {
+    wsrpc::Cache cache(1024 * 1024, std::chrono::milliseconds(0));
+    auto key = wsrpc::Cache::key("lookup", R"({"a": 1})");
+    REQUIRE(key);
+    CHECK_FALSE(cache.find(*key));
+
+    cache.store(*key, {R"("result":1})", {wsrpc::binary_t(4)}, false});
+    auto hit = cache.find(*key);
+    REQUIRE(hit);
+    CHECK(hit->tail == R"("result":1})");
+    CHECK(hit->atts.size() == 1);
+    CHECK_FALSE(hit->compress);
+
+    // Replaced, not duplicated
+    cache.store(*key, {R"("result":2})", {}, true});
+    CHECK(cache.find(*key)->tail == R"("result":2})");
+    CHECK(cache.size() == 1);
+  }
+
+  TEST_CASE("Cache key")
+  {
+    // Whitespace does not matter, method and params do
+    CHECK(wsrpc::Cache::key("m", R"({"a": [1, 2]})") == wsrpc::Cache::key("m", R"({"a":[1,2]})"));
+    CHECK(wsrpc::Cache::key("m", "1") != wsrpc::Cache::key("n", "1"));
+    CHECK(wsrpc::Cache::key("m", "1") != wsrpc::Cache::key("m", "2"));
+  }
+
+  TEST_CASE("Cache ttl" * doctest::timeout(5.0))
+  {
+    wsrpc::Cache cache(1024 * 1024, std::chrono::milliseconds(10));
+    auto key = *wsrpc::Cache::key("m", "1");
+    cache.store(key, {R"("result":1})", {}, true});
+    CHECK(cache.find(key));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK_FALSE(cache.find(key));
+    CHECK(cache.size() == 0);
+  }
+
+  TEST_CASE("Cache budget")
+  {
+    // 64 bytes a shard
+    wsrpc::Cache cache(wsrpc::Cache::shards * 64, std::chrono::milliseconds(0));
+
+    // Larger than a shard, never kept
+    auto big = *wsrpc::Cache::key("m", "0");
+    cache.store(big, {std::string(100, 'x'), {}, true});
+    CHECK_FALSE(cache.find(big));
+
+    for (int i = 0; i < 1000; ++i)  //
+      cache.store(*wsrpc::Cache::key("m", std::to_string(i)), {std::string(20, 'x'), {}, true});
+    // The least recently used ones make room, two fit a shard
+    CHECK(cache.size() <= 2 * wsrpc::Cache::shards);
+    CHECK(cache.find(*wsrpc::Cache::key("m", "999")));
+  }
+
+  TEST_CASE("Flights join and land")
+  {
+    wsrpc::Flights flights;
+    std::vector<std::string> got;
+    auto follow = [&got]() -> wsrpc::Flights::waiter_t {
+      return [&got](const wsrpc::Cache::entry_t* entry) { got.push_back(entry ? entry->tail : "none"); };
+    };
+
+    // The first call runs, the next ones wait on it
+    CHECK_FALSE(flights.join("k", follow));
+    CHECK(flights.join("k", follow));
+    CHECK(flights.join("k", follow));
+    CHECK_FALSE(flights.join("other", follow));
+    CHECK(got.empty());
+
+    wsrpc::Cache::entry_t entry{R"("result":1})", {}, true};
+    flights.land("k", &entry);
+    CHECK(got == std::vector<std::string>{R"("result":1})", R"("result":1})"});
+    flights.land("other", nullptr);
+    CHECK(flights.size() == 0);
+
+    // Landed, so the next one runs again
+    CHECK_FALSE(flights.join("k", follow));
+  }
+}
+
@@ -51,5 +51,44 @@ TEST_SUITE("message")
     CHECK(wsrpc::error::format(wsrpc::error::METHOD_UNAVAIABLE, "MI3") == "Method Unavaiable : MI3");
     CHECK(wsrpc::error::format(wsrpc::error::INVALID_PARAMS, "MI4") == "Invalid Params : MI4");
     CHECK(wsrpc::error::format(wsrpc::error::INTERNAL_ERROR, "MI5") == "Internal Error : MI5");
+    CHECK(wsrpc::error::format(wsrpc::error::SERVER_BUSY, "MI6") == "Server Busy : MI6");
+    CHECK(wsrpc::error::format(wsrpc::error::REQUEST_CANCELLED, "MI7") == "Request Cancelled : MI7");
+    CHECK(wsrpc::error::format(wsrpc::error::DEADLINE_EXCEEDED, "MI8") == "Deadline Exceeded : MI8");
   }
-}
\ No newline at end of file
+
+  TEST_CASE("attach_t struct")
+  {
+    wsrpc::attach_t att;
+
+    // Test default construction
+    CHECK(att.empty());
+    CHECK(att.size() == 0);
+
+    // Test construction from owned bytes
+    wsrpc::binary_t data{std::byte('a'), std::byte('b'), std::byte('c')};
+    wsrpc::attach_t att2 = data;
+    CHECK(att2.size() == 3);
+    CHECK(att2.data() != data.data());
+
+    // Test construction from shared bytes, copies share them
+    auto shared = std::make_shared<const wsrpc::binary_t>(data);
+    wsrpc::attachs_t atts{shared, shared};
+    CHECK(atts[0].data() == shared->data());
+    CHECK(atts[1].data() == shared->data());
+    auto copied = atts;
+    CHECK(copied[0].data() == shared->data());
+    CHECK(shared.use_count() == 5);
+
+    // Test construction from any owner
+    auto raw = std::make_shared<const std::string>("hello");
+    wsrpc::attach_t att3{raw, std::as_bytes(std::span(raw->data(), raw->size()))};
+    CHECK(att3.size() == 5);
+    CHECK(reinterpret_cast<const char*>(att3.data()) == raw->data());
+
+    // Test compression flag, already compressed data opts out
+    CHECK(att3.compress());
+    att3.compress(false);
+    CHECK_FALSE(att3.compress());
+    CHECK_FALSE(wsrpc::attach_t(shared).compress(false).compress());
+  }
+}
@@ -0,0 +1,98 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <wsrpc/metrics.hpp>
+
+TEST_SUITE("metrics")
+{
+  TEST_CASE("Metrics counter sums every thread" * doctest::timeout(5.0))
+  {
+    wsrpc::Counter counter;
+    {
+      std::vector<std::jthread> threads;
+      for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&counter]() {
+          for (int i = 0; i < 1000; ++i) counter.add();
+        });
+      }
+    }
+    counter.add(10);
+
+    CHECK(counter.value() == 8010);
+  }
+
+  TEST_CASE("Metrics histogram buckets")
+  {
+    using namespace std::chrono_literals;
+    wsrpc::Histogram histogram;
+    histogram.observe(5us);
+    histogram.observe(10us);
+    histogram.observe(300us);
+    histogram.observe(1min);
+
+    auto snap = histogram.snapshot();
+    // Cumulative, bounds included in their bucket, the overflow only in the last one
+    CHECK(snap.buckets[0] == 2);
+    CHECK(snap.buckets[3] == 2);
+    CHECK(snap.buckets[4] == 3);
+    CHECK(snap.buckets[wsrpc::Histogram::bounds_us.size() - 1] == 3);
+    CHECK(snap.buckets.back() == 4);
+    CHECK(snap.count == 4);
+    CHECK(snap.sum_secs == doctest::Approx(60.000315));
+
+    // Rounded to the nearest microsecond rather than truncated
+    wsrpc::Histogram rounded;
+    rounded.observe(10'400ns);
+    rounded.observe(10'600ns);
+    CHECK(rounded.snapshot().buckets[0] == 1);
+  }
+
+  TEST_CASE("Metrics method lookup")
+  {
+    wsrpc::Metrics metrics;
+    auto echo = metrics.method("echo");
+
+    // Found again rather than built twice
+    CHECK(metrics.method("echo") == echo);
+    CHECK(metrics.method("other") != echo);
+  }
+
+  TEST_CASE("Metrics render")
+  {
+    using namespace std::chrono_literals;
+    wsrpc::Metrics metrics;
+    metrics.connections_opened.add(3);
+    metrics.connections_closed.add(1);
+    metrics.bytes_in.add(42);
+    metrics.method("echo")->exec.observe(20us);
+    metrics.method("")->wait.observe(1ms);
+
+    auto text = metrics.render();
+    CHECK(text.find("# TYPE wsrpc_bytes_in_total counter\nwsrpc_bytes_in_total 42\n") != text.npos);
+    CHECK(text.find("# TYPE wsrpc_connections gauge\nwsrpc_connections 2\n") != text.npos);
+    CHECK(text.find("# TYPE wsrpc_call_exec_seconds histogram\n") != text.npos);
+    CHECK(text.find("wsrpc_call_exec_seconds_bucket{method=\"echo\",le=\"1e-05\"} 0\n") != text.npos);
+    CHECK(text.find("wsrpc_call_exec_seconds_bucket{method=\"echo\",le=\"5e-05\"} 1\n") != text.npos);
+    CHECK(text.find("wsrpc_call_exec_seconds_bucket{method=\"echo\",le=\"+Inf\"} 1\n") != text.npos);
+    CHECK(text.find("wsrpc_call_exec_seconds_count{method=\"echo\"} 1\n") != text.npos);
+    CHECK(text.find("wsrpc_call_wait_seconds_count{method=\"(unknown)\"} 1\n") != text.npos);
+  }
+
+  TEST_CASE("Metrics render labels")
+  {
+    using namespace std::chrono_literals;
+    wsrpc::Metrics metrics;
+    metrics.method("a\"b\\c\nd")->exec.observe(20us);
+    metrics.method("")->coalesced.add();
+
+    auto text = metrics.render();
+    // Escaped, and unknown methods under the same name in every family
+    CHECK(text.find("wsrpc_call_exec_seconds_count{method=\"a\\\"b\\\\c\\nd\"} 1\n") != text.npos);
+    CHECK(text.find("wsrpc_coalesced_total{method=\"(unknown)\"} 1\n") != text.npos);
+    CHECK(text.find("method=\"\"") == text.npos);
+  }
+}
@@ -0,0 +1,363 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <wsrpc/scheduler.hpp>
+
+TEST_SUITE("scheduler")
+{
+  TEST_CASE("Scheduler runs submitted tasks" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(4);
+    CHECK(scheduler.threads_num() == 4);
+
+    auto queue = scheduler.make_queue();
+    std::atomic<int> count{0};
+    for (int i = 0; i < 1000; ++i) queue->submit([&count]() { count++; });
+    queue->wait();
+
+    CHECK(count.load() == 1000);
+    CHECK(queue->size() == 0);
+  }
+
+  TEST_CASE("Scheduler queue purge" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(1);
+
+    auto queue = scheduler.make_queue();
+    std::atomic<int> count{0};
+    for (int i = 0; i < 100; ++i) {
+      queue->submit([&count]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        count++;
+      });
+    }
+    auto dropped = queue->purge();
+    queue->wait();
+
+    // At most the task already running survives the purge
+    CHECK(dropped >= 99);
+    CHECK(count.load() + dropped == 100);
+  }
+
+  TEST_CASE("Scheduler queue drained" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(1);
+
+    auto queue = scheduler.make_queue();
+    std::atomic<int> count{0};
+    std::binary_semaphore done{0};
+    std::thread::id caller = std::this_thread::get_id();
+    std::thread::id called;
+    for (int i = 0; i < 10; ++i) {
+      queue->submit([&count]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        count++;
+      });
+    }
+    queue->drained([&]() {
+      called = std::this_thread::get_id();
+      done.release();
+    });
+
+    // Once, by the worker finishing the last task, without anyone blocking on the queue
+    done.acquire();
+    CHECK(count.load() == 10);
+    CHECK(queue->size() == 0);
+    CHECK(called != caller);
+
+    // Right away when there is nothing left
+    queue->drained([&]() { called = std::this_thread::get_id(); });
+    CHECK(called == caller);
+  }
+
+  TEST_CASE("Scheduler queue pause and resume" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(2);
+
+    auto queue = scheduler.make_queue();
+    std::atomic<int> count{0};
+    queue->pause();
+    CHECK(queue->paused());
+    for (int i = 0; i < 100; ++i) queue->submit([&count]() { count++; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // Nothing runs while paused, the tasks stay queued
+    CHECK(count.load() == 0);
+    CHECK(queue->size() == 100);
+
+    // Other queues are not held back
+    auto other = scheduler.make_queue();
+    other->submit([&count]() { count += 1000; });
+    other->wait();
+    CHECK(count.load() == 1000);
+
+    queue->resume();
+    CHECK_FALSE(queue->paused());
+    queue->wait();
+    CHECK(count.load() == 1100);
+  }
+
+  TEST_CASE("Scheduler serves lower lanes first" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(1);
+
+    auto queue = scheduler.make_queue();
+    std::mutex mutex;
+    std::vector<int> order;
+    queue->pause();
+    for (int i = 0; i < 3; ++i) {
+      queue->submit(
+        [&, i]() {
+          std::lock_guard lock(mutex);
+          order.push_back(10 + i);
+        },
+        2);
+    }
+    for (int i = 0; i < 3; ++i) {
+      queue->submit(
+        [&, i]() {
+          std::lock_guard lock(mutex);
+          order.push_back(i);
+        },
+        0);
+    }
+    queue->resume();
+    queue->wait();
+
+    // Submitted later, yet run earlier, each lane in its own order
+    CHECK(order == std::vector<int>{0, 1, 2, 10, 11, 12});
+  }
+
+  TEST_CASE("Scheduler gate caps concurrency" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(4);
+
+    auto gate = scheduler.make_gate(2);
+    std::atomic<int> now{0};
+    std::atomic<int> peak{0};
+    std::atomic<int> done{0};
+    std::vector<std::shared_ptr<wsrpc::Scheduler::Queue>> queues;
+    for (int q = 0; q < 5; ++q) {
+      auto& queue = queues.emplace_back(scheduler.make_queue());
+      for (int i = 0; i < 10; ++i) {
+        queue->submit(
+          [&]() {
+            int n = ++now;
+            int p = peak.load();
+            while (n > p && !peak.compare_exchange_weak(p, n)) {}
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --now;
+            ++done;
+          },
+          1,
+          gate);
+      }
+    }
+    // Ungated tasks still get the idle workers
+    auto free = scheduler.make_queue();
+    free->submit([&done]() { done += 100; });
+    free->wait();
+    CHECK(done.load() >= 100);
+    for (auto& queue : queues) queue->wait();
+
+    // Spread over several queues, never more than the limit at once
+    CHECK(peak.load() <= 2);
+    CHECK(done.load() == 150);
+  }
+
+  TEST_CASE("Scheduler gate slot is held as long as the task keeps it" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(2);
+
+    auto gate = scheduler.make_gate(1);
+    auto queue = scheduler.make_queue();
+    auto other = scheduler.make_queue();
+    std::mutex mutex;
+    wsrpc::Scheduler::slot_t kept;
+    std::atomic<int> count{0};
+    queue->submit(
+      [&](wsrpc::Scheduler::slot_t slot) {
+        std::lock_guard lock(mutex);
+        kept = std::move(slot);
+      },
+      1,
+      gate);
+    queue->wait();
+    other->submit([&count]() { count++; }, 1, gate);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // Returned, yet still holding the only slot
+    CHECK(count.load() == 0);
+    {
+      std::lock_guard lock(mutex);
+      kept.reset();
+    }
+    other->wait();
+    CHECK(count.load() == 1);
+  }
+
+  TEST_CASE("Scheduler gate passes slots on past waiters purged or paused" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(4);
+
+    auto gate = scheduler.make_gate(1);
+    auto holder = scheduler.make_queue();
+    std::mutex mutex;
+    wsrpc::Scheduler::slot_t kept;
+    holder->submit(
+      [&](wsrpc::Scheduler::slot_t slot) {
+        std::lock_guard lock(mutex);
+        kept = std::move(slot);
+      },
+      1,
+      gate);
+    holder->wait();
+
+    std::atomic<int> count{0};
+    std::vector<std::shared_ptr<wsrpc::Scheduler::Queue>> queues;
+    for (int q = 0; q < 4; ++q) {
+      auto& queue = queues.emplace_back(scheduler.make_queue());
+      for (int i = 0; i < 5; ++i) queue->submit([&count]() { count++; }, 1, gate);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(count.load() == 0);
+
+    // The first waiters go away while parked, as when their connections close or backpressure
+    CHECK(queues[0]->purge() == 5);
+    queues[1]->pause();
+    {
+      std::lock_guard lock(mutex);
+      kept.reset();
+    }
+    queues[2]->wait();
+    queues[3]->wait();
+    CHECK(count.load() == 10);
+
+    queues[1]->resume();
+    queues[1]->wait();
+    CHECK(count.load() == 15);
+  }
+
+  TEST_CASE("Scheduler gate does not hold back its lane" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(2);
+
+    auto gate = scheduler.make_gate(1);
+    auto queue = scheduler.make_queue();
+    std::mutex mutex;
+    wsrpc::Scheduler::slot_t kept;
+    queue->submit(
+      [&](wsrpc::Scheduler::slot_t slot) {
+        std::lock_guard lock(mutex);
+        kept = std::move(slot);
+      },
+      1,
+      gate);
+    queue->wait();
+
+    std::atomic<int> gated{0};
+    std::atomic<int> behind{0};
+    std::atomic<int> beside{0};
+    queue->submit([&gated]() { gated++; }, 1, gate);
+    queue->submit([&behind]() { behind++; }, 1);
+    queue->submit([&beside]() { beside++; }, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // The gated task waits for its slot aside, the ungated one behind it in its lane goes on
+    CHECK(gated.load() == 0);
+    CHECK(behind.load() == 1);
+    CHECK(beside.load() == 1);
+    CHECK(queue->size() == 1);
+    {
+      std::lock_guard lock(mutex);
+      kept.reset();
+    }
+    queue->wait();
+    CHECK(gated.load() == 1);
+  }
+
+  TEST_CASE("Scheduler gate keeps the order of parked tasks" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(4);
+
+    auto gate = scheduler.make_gate(1);
+    auto holder = scheduler.make_queue();
+    std::mutex mutex;
+    wsrpc::Scheduler::slot_t kept;
+    holder->submit(
+      [&](wsrpc::Scheduler::slot_t slot) {
+        std::lock_guard lock(mutex);
+        kept = std::move(slot);
+      },
+      1,
+      gate);
+    holder->wait();
+
+    std::vector<int> order;
+    auto queue = scheduler.make_queue();
+    for (int i = 0; i < 5; ++i) {
+      queue->submit(
+        [&mutex, &order, i]() {
+          std::lock_guard lock(mutex);
+          order.push_back(i);
+        },
+        1,
+        gate);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    {
+      std::lock_guard lock(mutex);
+      CHECK(order.empty());
+      kept.reset();
+    }
+    queue->wait();
+
+    // Set aside one by one, yet run in the order they came
+    CHECK(order == std::vector<int>{0, 1, 2, 3, 4});
+  }
+
+  TEST_CASE("Scheduler is fair across queues" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(1);
+
+    auto busy = scheduler.make_queue();
+    auto idle = scheduler.make_queue();
+    std::atomic<int> busy_done{0};
+    std::atomic<int> busy_before_idle{-1};
+    for (int i = 0; i < 100; ++i) {
+      busy->submit([&busy_done]() {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        busy_done++;
+      });
+    }
+    idle->submit([&]() { busy_before_idle = busy_done.load(); });
+    idle->wait();
+
+    // The single task of the other queue is not stuck behind the whole backlog
+    CHECK(busy_before_idle.load() < 10);
+    busy->wait();
+    CHECK(busy_done.load() == 100);
+  }
+
+  TEST_CASE("Scheduler thread count is fixed" * doctest::timeout(5.0))
+  {
+    wsrpc::Scheduler scheduler(2);
+
+    std::vector<std::shared_ptr<wsrpc::Scheduler::Queue>> queues;
+    std::atomic<int> count{0};
+    for (int i = 0; i < 200; ++i) {
+      auto& queue = queues.emplace_back(scheduler.make_queue());
+      queue->submit([&count]() { count++; });
+    }
+    for (auto& queue : queues) queue->wait();
+
+    CHECK(scheduler.threads_num() == 2);
+    CHECK(count.load() == 200);
+  }
+}
@@ -1,5 +1,11 @@
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <stop_token>
+#include <vector>
 
 #include <doctest/doctest.h>
 #include <fmt/format.h>
@@ -52,6 +58,133 @@ TEST_SUITE("server")
     CHECK_FALSE(response.error.has_value());
   }
 
+  TEST_CASE("Server process function views params in place")
+  {
+    wsrpc::App app;
+
+    // Register a handler remembering where its params live
+    const char* seen = nullptr;
+    app.regist("test_method", [&seen](wsrpc::rawjson_view_t params) -> wsrpc::App::return_t {
+      seen = params.data();
+      return wsrpc::package_t{"null", {}};
+    });
+
+    const std::string request = R"({"id": "1", "method": "test_method", "params": {"data": [1, 2, 3]}})";
+    auto result = wsrpc::process(app, request);
+
+    CHECK_FALSE(glz::validate_json(result.resp));
+    // The params are not copied out of the request frame
+    REQUIRE(seen != nullptr);
+    CHECK(seen >= request.data());
+    CHECK(seen < request.data() + request.size());
+  }
+
+  TEST_CASE("Server process function with compression opt-out")
+  {
+    wsrpc::App app;
+
+    // Register a handler whose replies are not worth deflating
+    app.regist(
+      "test_method", [](wsrpc::rawjson_view_t) -> wsrpc::App::return_t { return wsrpc::package_t{"null", {}}; },
+      {.compress = false});
+    REQUIRE(app.find("test_method"));
+    CHECK_FALSE(app.find("test_method")->meta.compress);
+    CHECK(app.find("echo")->meta.compress);
+    CHECK_FALSE(app.find("missing"));
+
+    CHECK_FALSE(wsrpc::process(app, R"({"id": "1", "method": "test_method", "params": {}})").compress);
+    CHECK(wsrpc::process(app, R"({"id": "2", "method": "echo", "params": {}})").compress);
+
+    // A batch is compressed only if all its replies are
+    std::vector<wsrpc::packet_t> pkgs;
+    pkgs.push_back(wsrpc::process(app, R"({"id": "3", "method": "echo", "params": {}})"));
+    pkgs.push_back(wsrpc::process(app, R"({"id": "4", "method": "test_method", "params": {}})"));
+    CHECK_FALSE(wsrpc::merge(std::move(pkgs)).compress);
+  }
+
+  TEST_CASE("Server process function async")
+  {
+    wsrpc::App app;
+
+    // Register a handler finishing on another thread
+    app.regist_async("test_method", [](wsrpc::rawjson_view_t, wsrpc::context_t, wsrpc::App::done_t done) {
+      std::thread([done = std::move(done)]() mutable { done(wsrpc::package_t{"true", {}}); }).detach();
+    });
+
+    // The packet arrives through the callback
+    std::binary_semaphore ready{0};
+    wsrpc::packet_t pkg{};
+    wsrpc::process(app, R"({"id": "1", "method": "test_method", "params": {}})", {}, [&](wsrpc::packet_t&& p) {
+      pkg = std::move(p);
+      ready.release();
+    });
+    ready.acquire();
+    CHECK(pkg.resp == R"({"id":"1","result":true})");
+
+    // The blocking form waits for it
+    CHECK(wsrpc::process(app, R"({"id": "2", "method": "test_method", "params": {}})").resp ==
+          R"({"id":"2","result":true})");
+  }
+
+  TEST_CASE("Server pack function")
+  {
+    // Same bytes glaze writes for response_t, optional fields left out when empty
+    auto plain = wsrpc::response_t{.id = "1", .result = R"({"a": [1, 2]})"};
+    CHECK(wsrpc::pack(plain).resp == R"({"id":"1","result":{"a": [1, 2]}})");
+    CHECK(wsrpc::pack(plain).resp == glz::write_json(plain).value());
+
+    auto full = wsrpc::response_t{
+      .id = "a\"b\\c\n\x01", .result = "null", .error = "Err\t", .attachs = 12, .partial = true};
+    auto pkg = wsrpc::pack(full);
+    CHECK(pkg.resp == R"({"id":"a\"b\\c\n\u0001","result":null,"error":"Err\t","attachs":12,"partial":true})");
+    CHECK(pkg.resp == glz::write_json(full).value());
+    CHECK(pkg.error);
+  }
+
+  TEST_CASE("Server process function arena")
+  {
+    wsrpc::App app;
+    app.regist("scratch", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> wsrpc::App::return_t {
+      std::pmr::vector<int> scratch({1, 2, 3}, ctx.arena);
+      auto from_arena = ctx.arena != std::pmr::get_default_resource();
+      return wsrpc::package_t{fmt::format("[{},{}]", from_arena, fmt::join(scratch, ",")), {}};
+    });
+
+    // Plain handlers called through process get the arena of their thread
+    CHECK(wsrpc::process(app, R"({"id":"1","method":"scratch","params":null})").resp ==
+          R"({"id":"1","result":[true,1,2,3]})");
+    // Called directly, the heap
+    CHECK(app.handle("scratch", "null").value().first == "[false,1,2,3]");
+  }
+
+  TEST_CASE("Server partial function")
+  {
+    auto pkg = wsrpc::partial("5", wsrpc::package_t{R"({"rows": [1, 2]})", {wsrpc::binary_t(4)}});
+    CHECK(pkg.resp == R"({"id":"5","result":{"rows": [1, 2]},"attachs":1,"partial":true})");
+    REQUIRE(pkg.atts.size() == 1);
+    CHECK(pkg.atts[0].size() == 4);
+  }
+
+  TEST_CASE("Server memo and replay functions")
+  {
+    wsrpc::App app;
+    auto pkg = wsrpc::process(app, R"({"id":"1","method":"echo","params":{"a":1}})");
+    auto entry = wsrpc::memo(pkg, "1");
+    REQUIRE(entry);
+    CHECK(entry->tail == R"("result":{"a":1}})");
+
+    // Same response, answering another id
+    CHECK(wsrpc::replay("other \"id\"", *entry).resp == R"({"id":"other \"id\"","result":{"a":1}})");
+
+    // Errors are not worth keeping
+    auto error = wsrpc::process(app, R"({"id":"1","method":"unknown","params":null})");
+    CHECK(error.error);
+    CHECK_FALSE(wsrpc::memo(error, "1"));
+    // Yet shared with calls waiting on it
+    REQUIRE(wsrpc::untag(error, "1"));
+    CHECK(wsrpc::replay("2", *wsrpc::untag(error, "1")).resp.starts_with(R"({"id":"2","result":null,"error":)"));
+  }
+
   TEST_CASE("Server process function with invalid JSON")
   {
     wsrpc::App app;
@@ -92,6 +225,168 @@ TEST_SUITE("server")
     CHECK(response.error.value() == "Method Unavaiable : \"unknown_method\"");
   }
 
+  TEST_CASE("Server batch split and merge")
+  {
+    wsrpc::App app;
+
+    // Register a handler returning an attachment
+    app.regist("test_method", [](wsrpc::rawjson_view_t) -> wsrpc::App::return_t {
+      return wsrpc::package_t{"true", {wsrpc::binary_t{std::byte('x')}}};
+    });
+
+    CHECK(wsrpc::is_batch(R"( [{"id": "1"}])"));
+    CHECK_FALSE(wsrpc::is_batch(R"({"id": "1"})"));
+    CHECK_FALSE(wsrpc::is_batch(""));
+
+    // Test splitting a batch frame
+    std::string_view batch_request = R"([
+      {"id": "1", "method": "test_method", "params": {}},
+      {"id": "2", "method": "echo", "params": [1, 2]},
+      {"id": "3", "method": "test_method", "params": {}}
+    ])";
+    auto items = wsrpc::split(batch_request);
+    REQUIRE(items);
+    REQUIRE(items->size() == 3);
+    CHECK(batch_request.find(items->at(1)) != std::string_view::npos);
+
+    // Test merging the responses into one array
+    std::vector<wsrpc::packet_t> pkgs;
+    for (auto item : *items) pkgs.push_back(wsrpc::process(app, item));
+    auto result = wsrpc::merge(std::move(pkgs));
+
+    CHECK_FALSE(glz::validate_json(result.resp));
+    CHECK(result.atts.size() == 2);
+
+    std::vector<wsrpc::response_t> responses{};
+    auto pe = glz::read_json(responses, result.resp);
+    REQUIRE_FALSE(pe);
+    REQUIRE(responses.size() == 3);
+    CHECK(responses[0].id == "1");
+    CHECK(responses[0].attachs == 1);
+    CHECK(responses[1].id == "2");
+    CHECK(responses[1].result.str == "[1, 2]");
+    CHECK_FALSE(responses[1].attachs.has_value());
+    CHECK(responses[2].id == "3");
+
+    // Test invalid and empty batches
+    CHECK_FALSE(wsrpc::split(R"([{"id": "1")"));
+    CHECK(wsrpc::merge({}).resp == "[]");
+  }
+
+  TEST_CASE("Server refuse function")
+  {
+    // A refused request is answered by its id without running
+    auto pkg = wsrpc::refuse(R"({"id": "7", "method": "echo", "params": {}})", wsrpc::error::SERVER_BUSY, "test");
+    CHECK_FALSE(glz::validate_json(pkg.resp));
+    wsrpc::response_t response{};
+    REQUIRE_FALSE(glz::read_json(response, pkg.resp));
+    CHECK(response.id == "7");
+    CHECK(response.error == wsrpc::error::format(wsrpc::error::SERVER_BUSY, "test"));
+
+    // Each request of a batch gets its own error
+    auto batch = wsrpc::refuse(
+      R"([{"id": "1", "method": "echo", "params": {}}, {"id": "2", "method": "echo", "params": {}}])",
+      wsrpc::error::SERVER_BUSY,
+      "test");
+    std::vector<wsrpc::response_t> responses{};
+    REQUIRE_FALSE(glz::read_json(responses, batch.resp));
+    REQUIRE(responses.size() == 2);
+    CHECK(responses[1].id == "2");
+    CHECK(responses[1].error.has_value());
+  }
+
+  TEST_CASE("Server cancel message")
+  {
+    CHECK(wsrpc::cancelled(R"({"method": "$/cancel", "params": {"id": "3"}})") == "3");
+    CHECK(wsrpc::cancelled(R"({"method": "$/cancel", "params": {}})") == "");
+    CHECK_FALSE(wsrpc::cancelled(R"({"id": "1", "method": "echo", "params": {}})"));
+    CHECK_FALSE(wsrpc::cancelled(R"({"id": "1", "method": "echo", "params": "$/cancel"})"));
+  }
+
+  TEST_CASE("Server process function with uploaded attachments")
+  {
+    wsrpc::App app;
+
+    // Register a handler answering with the sizes of its uploads
+    app.regist("test_method", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> wsrpc::App::return_t {
+      std::vector<size_t> sizes;
+      for (auto& att : ctx.attachs) sizes.push_back(att.size());
+      return wsrpc::package_t{glz::write_json(sizes).value_or("null"), {}};
+    });
+
+    std::string_view request = R"({"id": "1", "method": "test_method", "params": {}, "attachs": 2})";
+    wsrpc::attachs_t attachs{wsrpc::binary_t(3), wsrpc::binary_t(5)};
+    auto result = wsrpc::process(app, request, {.attachs = std::move(attachs)});
+
+    wsrpc::response_t response{};
+    auto pe = glz::read_json(response, result.resp);
+    REQUIRE_FALSE(pe);
+    CHECK(response.result.str == "[3,5]");
+
+    // Uploads not matching the attachs count are an error, not handed to the handler
+    auto mismatch = wsrpc::process(app, request, {.attachs = {wsrpc::binary_t(3)}});
+    REQUIRE_FALSE(glz::read_json(response, mismatch.resp));
+    REQUIRE(response.error.has_value());
+    CHECK(response.error.value().starts_with("Invalid Request : 2 attachs expected, 1 uploaded"));
+
+    // Test dealing uploads out to the requests of a batch
+    std::vector<std::string_view> requests{
+      R"({"id": "1", "method": "test_method", "params": {}, "attachs": 1})",
+      R"({"id": "2", "method": "test_method", "params": {}})",
+      R"({"id": "3", "method": "test_method", "params": {}, "attachs": 2})",
+    };
+    auto slices = wsrpc::bind(requests, {wsrpc::binary_t(1), wsrpc::binary_t(2), wsrpc::binary_t(3)});
+    REQUIRE(slices.size() == 3);
+    REQUIRE(slices[0].size() == 1);
+    CHECK(slices[0][0].size() == 1);
+    CHECK(slices[1].empty());
+    REQUIRE(slices[2].size() == 2);
+    CHECK(slices[2][1].size() == 3);
+  }
+
+  TEST_CASE("Server binary protocol")
+  {
+    // Test subprotocol negotiation
+    CHECK(wsrpc::negotiate("").first == wsrpc::encoding_t::JSON);
+    CHECK(wsrpc::negotiate("").second.empty());
+    CHECK(wsrpc::negotiate("wsrpc.beve").first == wsrpc::encoding_t::BEVE);
+    CHECK(wsrpc::negotiate("chat, wsrpc.beve, wsrpc.json").second == wsrpc::subprotocol::BEVE);
+    CHECK(wsrpc::negotiate("wsrpc.json, wsrpc.beve").first == wsrpc::encoding_t::JSON);
+    CHECK(wsrpc::negotiate("chat").second.empty());
+
+    wsrpc::App app;
+
+    // Register a handler returning an attachment
+    app.regist("test_method", [](wsrpc::rawjson_view_t params) -> wsrpc::App::return_t {
+      return wsrpc::package_t{wsrpc::rawjson_t(params), {wsrpc::binary_t{std::byte('a'), std::byte('b')}}};
+    });
+
+    // Test a BEVE request round trip
+    auto request = glz::read_json<glz::json_t>(R"({"id": "1", "method": "test_method", "params": [1.5, 2.5]})");
+    REQUIRE(request);
+    auto raw = glz::write_beve(*request);
+    REQUIRE(raw);
+    auto json = wsrpc::from_beve(*raw);
+    REQUIRE(json);
+    auto result = wsrpc::process(app, *json);
+    auto beve = wsrpc::to_beve(result);
+    REQUIRE_FALSE(beve.empty());
+
+    std::string frame{};
+    REQUIRE_FALSE(glz::beve_to_json(beve, frame));
+    CHECK(frame == R"({"message":{"id":"1","result":[1.5,2.5],"attachs":1},"attachs":["ab"]})");
+
+    // A frame that does not decode is told so, rather than dropped
+    auto undecodable = wsrpc::from_beve("\xff\xff");
+    REQUIRE_FALSE(undecodable);
+    CHECK_FALSE(undecodable.error().empty());
+
+    // A response that is not JSON is answered with an error, never an empty frame
+    frame.clear();
+    REQUIRE_FALSE(glz::beve_to_json(wsrpc::to_beve({R"({"id":"2","result":nope})", {}}), frame));
+    CHECK(frame.starts_with(R"({"message":{"id":"2","result":null,"error":"Invalid Response)"));
+  }
+
   TEST_CASE("Server serve function echo")
   {
     static const auto host = "127.0.0.1";
@@ -123,6 +418,910 @@ if __name__ == '__main__':
     CHECK(*ret == R"({"id":"1","result":{}})");
   }
 
+  TEST_CASE("Server serve function io_threads")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    auto s = std::jthread([&]() {
+      CHECK_NOTHROW(wsrpc::serve<wsrpc::App>({.host = host, .port = port, .io_threads = 4}));
+    });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def call(session, url, id):
+    client = await session.ws_connect(url)
+    req = '{\"id\":\"' + str(id) + '\",\"method\":\"echo\",\"params\":{}}'
+    await client.send_str(req)
+    res = await client.receive_str()
+    await client.close()
+    return res
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    res = await asyncio.gather(*[call(session, url, i) for i in range(16)])
+    print(len([r for i, r in enumerate(res) if r == '{\"id\":\"' + str(i) + '\",\"result\":{}}']), end='')
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    CHECK(*ret == "16");
+  }
+
+  TEST_CASE("Server serve function batch")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<wsrpc::App>({host, port})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    req = '[' + ','.join('{\"id\":\"' + str(i) + '\",\"method\":\"echo\",\"params\":' + str(i) + '}' for i in range(3)) + ']'
+    await client.send_str(req)
+    res = await client.receive_str()
+    print(res, end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    CHECK(*ret == R"([{"id":"0","result":0},{"id":"1","result":1},{"id":"2","result":2}])");
+  }
+
+  TEST_CASE("Server serve function upload")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("upload", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> wsrpc::App::return_t {
+          size_t size = 0;
+          for (auto& att : ctx.attachs) size += att.size();
+          return wsrpc::package_t{std::to_string(size), {}};
+        });
+      }
+    };
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({host, port})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    await client.send_bytes(bytes(1000))
+    await client.send_bytes(bytes(24))
+    req = '{\"id\":\"1\",\"method\":\"upload\",\"params\":{},\"attachs\":2}'
+    await client.send_str(req)
+    res = await client.receive_str()
+    print(res, end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    CHECK(*ret == R"({"id":"1","result":1024})");
+  }
+
+  TEST_CASE("Server serve function upload limit")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    auto s = std::jthread(
+      [&]() { CHECK_NOTHROW(wsrpc::serve<wsrpc::App>({.host = host, .port = port, .max_attachs = 2})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    for i in range(3):
+        await client.send_bytes(bytes(10))
+    msg = await client.receive()
+    print(msg.type.name, msg.data, end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // Uploads past the limit close the connection rather than pile up
+    CHECK(*ret == "CLOSE 1009");
+  }
+
+  TEST_CASE("Server serve function queue limit")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("slow", [](wsrpc::rawjson_view_t) -> return_t {
+          std::this_thread::sleep_for(std::chrono::milliseconds(200));
+          return wsrpc::package_t{"null", {}};
+        });
+      }
+    };
+
+    auto s = std::jthread(
+      [&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 1, .max_queued = 2})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    for i in range(3):
+        await client.send_str('{\"id\":\"' + str(i) + '\",\"method\":\"slow\",\"params\":null}')
+    res = [await client.receive_str() for i in range(3)]
+    print(' '.join(res), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // Past the limit, refused at once even though reject_busy is off
+    CHECK(ret->starts_with(R"({"id":"2","result":null,"error":"Server Busy)"));
+    CHECK(ret->ends_with(R"({"id":"0","result":null} {"id":"1","result":null})"));
+  }
+
+  TEST_CASE("Server serve function cancel")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("slow", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> return_t {
+          for (int i = 0; i < 200; ++i) {
+            if (ctx.token.stop_requested()) return wsrpc::package_t{R"("stopped")", {}};
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          }
+          return wsrpc::package_t{R"("finished")", {}};
+        });
+        regist("fast", [](wsrpc::rawjson_view_t) -> return_t { return wsrpc::package_t{R"("done")", {}}; });
+      }
+    };
+
+    // A single worker, so that the second request waits behind the first
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 1})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    await client.send_str('{\"id\":\"1\",\"method\":\"slow\",\"params\":null}')
+    await asyncio.sleep(0.2)
+    await client.send_str('{\"id\":\"2\",\"method\":\"slow\",\"params\":null}')
+    for id in ('2', '1'):
+        await client.send_str('{\"method\":\"$/cancel\",\"params\":{\"id\":\"' + id + '\"}}')
+    res = sorted([await client.receive_str(), await client.receive_str()])
+    await client.send_str('{\"method\":\"$/cancel\",\"params\":{\"id\":\"1\"}}')
+    await client.send_str('{\"id\":\"1\",\"method\":\"fast\",\"params\":null}')
+    res.append(await client.receive_str())
+    print(' '.join(res), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // The running one stops early, the queued one never runs
+    CHECK(ret->find(R"({"id":"1","result":"stopped"})") != std::string::npos);
+    CHECK(ret->find(R"({"id":"2","result":null,"error":"Request Cancelled)") != std::string::npos);
+    // A late cancel of a finished request is not held against the next one reusing its id
+    CHECK(ret->ends_with(R"({"id":"1","result":"done"})"));
+  }
+
+  TEST_CASE("Server serve function cancel finishing on stop")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+    using on_stop_t = std::stop_callback<std::move_only_function<void()>>;
+    static std::mutex mutex;
+    static std::vector<std::unique_ptr<on_stop_t>> waiting;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist_async("wait", [](wsrpc::rawjson_view_t, wsrpc::context_t ctx, done_t done) {
+          // Finished by its token alone, right as the cancel comes in
+          auto on_stop = std::make_unique<on_stop_t>(ctx.token, [done = std::move(done)]() mutable {
+            done(wsrpc::package_t{R"("stopped")", {}});
+          });
+          std::lock_guard lock(mutex);
+          waiting.push_back(std::move(on_stop));
+        });
+      }
+    };
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    await client.send_str('{\"id\":\"1\",\"method\":\"wait\",\"params\":null}')
+    await asyncio.sleep(0.1)
+    await client.send_str('{\"method\":\"$/cancel\",\"params\":{\"id\":\"1\"}}')
+    await client.send_str('{\"id\":\"2\",\"method\":\"echo\",\"params\":[2]}')
+    res = [await asyncio.wait_for(client.receive_str(), 5) for i in range(2)]
+    print(' '.join(res), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // The loop that cancelled it is not held up by its reply
+    CHECK(*ret == R"({"id":"1","result":"stopped"} {"id":"2","result":[2]})");
+  }
+
+  TEST_CASE("Server serve function close while running")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("slow", [](wsrpc::rawjson_view_t) -> return_t {
+          std::this_thread::sleep_for(std::chrono::milliseconds(500));
+          return wsrpc::package_t{"null", {}};
+        });
+      }
+    };
+
+    // A single loop, shared by both connections
+    auto s = std::jthread(
+      [&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 2, .io_threads = 1})); });
+
+    auto code = R"(
+import sys
+import time
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    leaving = await session.ws_connect(url)
+    staying = await session.ws_connect(url)
+    await leaving.send_str('{\"id\":\"1\",\"method\":\"slow\",\"params\":null}')
+    await asyncio.sleep(0.1)
+    await leaving.close()
+    t = time.time()
+    await staying.send_str('{\"id\":\"2\",\"method\":\"echo\",\"params\":[2]}')
+    res = await staying.receive_str()
+    print(res, time.time() - t < 0.25, end='')
+    await staying.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // The loop does not wait on the call of the closed socket before serving the other one
+    CHECK(*ret == R"({"id":"2","result":[2]} True)");
+  }
+
+  TEST_CASE("Server serve function async")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist_async("wait", [](wsrpc::rawjson_view_t params, wsrpc::context_t, done_t done) {
+          std::thread([params = wsrpc::rawjson_t(params), done = std::move(done)]() mutable {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            done(wsrpc::package_t{params, {}});
+          }).detach();
+        });
+      }
+    };
+
+    // A single worker still has all the waits in flight at once
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 1})); });
+
+    auto code = R"(
+import sys
+import time
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    t = time.time()
+    for i in range(20):
+        await client.send_str('{\"id\":\"' + str(i) + '\",\"method\":\"wait\",\"params\":' + str(i) + '}')
+    res = [await client.receive_str() for i in range(20)]
+    print(len(res), time.time() - t < 5, end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    CHECK(*ret == "20 True");
+  }
+
+  TEST_CASE("Server serve function stream")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("count", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> return_t {
+          for (int i = 0; i < 3; ++i) {
+            ctx.emit(wsrpc::package_t{std::to_string(i), {}});
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          }
+          return wsrpc::package_t{"3", {}};
+        });
+      }
+    };
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({host, port})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    await client.send_str('{\"id\":\"1\",\"method\":\"count\",\"params\":null}')
+    res = [await client.receive_str() for i in range(4)]
+    print(' '.join(res), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // Chunks arrive in order, the final response ends the stream
+    CHECK(
+      *ret ==
+      R"({"id":"1","result":0,"partial":true} {"id":"1","result":1,"partial":true} {"id":"1","result":2,"partial":true} {"id":"1","result":3})");
+  }
+
+  TEST_CASE("Server serve function stream backpressure")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+    static std::atomic<int> refused{0};
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("flood", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> return_t {
+          auto chunk = '"' + std::string(4 * 1024 * 1024, 'x') + '"';
+          for (int i = 0; i < 32; ++i)
+            if (!ctx.emit(wsrpc::package_t{chunk, {}})) refused++;
+          return wsrpc::package_t{"32", {}};
+        });
+      }
+    };
+
+    // Far more than the send buffer holds before dropping frames, with a client slow to start reading
+    auto s = std::jthread([&]() {
+      CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .backpressure_limit = 8 * 1024 * 1024}));
+    });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession(max_msg_size=0)
+    client = await session.ws_connect(url, max_msg_size=0)
+    await client.send_str('{\"id\":\"1\",\"method\":\"flood\",\"params\":null}')
+    await asyncio.sleep(1)
+    res = [await client.receive_str() for i in range(33)]
+    print(sum(len(r) > 1024 for r in res), res[-1], end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // emit waits for the client instead of piling up frames until they are dropped
+    CHECK(*ret == R"(32 {"id":"1","result":32})");
+    CHECK(refused.load() == 0);
+  }
+
+  TEST_CASE("Server serve function deadline")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist(
+          "slow",
+          [](wsrpc::rawjson_view_t) -> return_t {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            return wsrpc::package_t{"null", {}};
+          },
+          {.max_concurrency = 1, .priority = wsrpc::priority_t::LOW});
+        regist(
+          "quick",
+          [](wsrpc::rawjson_view_t) -> return_t { return wsrpc::package_t{"null", {}}; },
+          {.deadline = std::chrono::milliseconds(100)});
+      }
+    };
+
+    // A single worker, so that the quick request waits behind the slow one
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 1})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    await client.send_str('{\"id\":\"1\",\"method\":\"slow\",\"params\":null}')
+    await asyncio.sleep(0.1)
+    await client.send_str('{\"id\":\"2\",\"method\":\"quick\",\"params\":null}')
+    res = [await client.receive_str() for i in range(2)]
+    print(' '.join(res), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // Expired while queued, answered once a worker reaches it
+    CHECK(*ret == R"({"id":"1","result":null} {"id":"2","result":null,"error":"Deadline Exceeded : 100ms"})");
+  }
+
+  TEST_CASE("Server serve function gate")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist(
+          "heavy",
+          [](wsrpc::rawjson_view_t params) -> return_t {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            return wsrpc::package_t{wsrpc::rawjson_t(params), {}};
+          },
+          {.max_concurrency = 1});
+        regist("cheap", [](wsrpc::rawjson_view_t params) -> return_t {
+          return wsrpc::package_t{wsrpc::rawjson_t(params), {}};
+        });
+      }
+    };
+
+    // Workers to spare, so that only the gate holds the second heavy call back
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 2})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    await client.send_str('{\"id\":\"1\",\"method\":\"heavy\",\"params\":1}')
+    await client.send_str('{\"id\":\"2\",\"method\":\"heavy\",\"params\":2}')
+    await asyncio.sleep(0.1)
+    await client.send_str('{\"id\":\"3\",\"method\":\"cheap\",\"params\":3}')
+    res = [await client.receive_str() for i in range(3)]
+    print(' '.join(res), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // The cheap call of the same lane does not wait behind the heavy one waiting for the gate
+    CHECK(*ret == R"({"id":"3","result":3} {"id":"1","result":1} {"id":"2","result":2})");
+  }
+
+  TEST_CASE("Server serve function cache")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+    static std::atomic<int> called{0};
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist(
+          "lookup",
+          [](wsrpc::rawjson_view_t params) -> return_t {
+            called++;
+            return wsrpc::package_t{wsrpc::rawjson_t(params), {}};
+          },
+          {.cacheable = true});
+      }
+    };
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect(url)
+    res = []
+    for id, params in (('1', '[1, 2]'), ('2', '[1,2]'), ('3', '[3]')):
+        await client.send_str('{\"id\":\"' + id + '\",\"method\":\"lookup\",\"params\":' + params + '}')
+        res.append(await client.receive_str())
+    print(' '.join(res), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // The second call replays the first under its own id
+    CHECK(*ret == R"({"id":"1","result":[1, 2]} {"id":"2","result":[1, 2]} {"id":"3","result":[3]})");
+    CHECK(called.load() == 2);
+  }
+
+  TEST_CASE("Server serve function coalesce")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+    static std::atomic<int> called{0};
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist(
+          "expensive",
+          [](wsrpc::rawjson_view_t params) -> return_t {
+            called++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            return wsrpc::package_t{wsrpc::rawjson_t(params), {}};
+          },
+          {.coalesce = true});
+      }
+    };
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    clients = [await session.ws_connect(url) for i in range(3)]
+    for i, client in enumerate(clients):
+        await client.send_str('{\"id\":\"' + str(i) + '\",\"method\":\"expensive\",\"params\":[1]}')
+    res = [await client.receive_str() for client in clients]
+    print(' '.join(res), end='')
+    for client in clients:
+        await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // Run once over all connections, each answered under its own id
+    CHECK(*ret == R"({"id":"0","result":[1]} {"id":"1","result":[1]} {"id":"2","result":[1]})");
+    CHECK(called.load() == 1);
+  }
+
+  TEST_CASE("Server serve function coalesce refused")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+    static std::atomic<int> called{0};
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("block", [](wsrpc::rawjson_view_t) -> return_t {
+          std::this_thread::sleep_for(std::chrono::milliseconds(300));
+          return wsrpc::package_t{"null", {}};
+        });
+        regist(
+          "expensive",
+          [](wsrpc::rawjson_view_t params) -> return_t {
+            called++;
+            return wsrpc::package_t{wsrpc::rawjson_t(params), {}};
+          },
+          {.coalesce = true});
+      }
+    };
+
+    // A single worker, so that the first call waits in its queue long enough to be cancelled there
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 1})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    clients = [await session.ws_connect(url) for i in range(3)]
+    await clients[0].send_str('{\"id\":\"b\",\"method\":\"block\",\"params\":null}')
+    await asyncio.sleep(0.05)
+    for i, client in enumerate(clients):
+        await client.send_str('{\"id\":\"' + str(i) + '\",\"method\":\"expensive\",\"params\":[1]}')
+    await asyncio.sleep(0.05)
+    for i in (2, 0):
+        await clients[i].send_str('{\"method\":\"$/cancel\",\"params\":{\"id\":\"' + str(i) + '\"}}')
+    res = [await clients[2].receive_str(), await clients[1].receive_str()]
+    res += sorted([await clients[0].receive_str(), await clients[0].receive_str()])
+    print(' '.join(res), end='')
+    for client in clients:
+        await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // A cancelled follower is answered at once, the others do not share the refusal of the first call but run
+    CHECK(ret->starts_with(R"({"id":"2","result":null,"error":"Request Cancelled)"));
+    CHECK(ret->find(R"({"id":"1","result":[1]})") != std::string::npos);
+    CHECK(ret->find(R"({"id":"0","result":null,"error":"Request Cancelled)") != std::string::npos);
+    CHECK(ret->find(R"({"id":"b","result":null})") != std::string::npos);
+    CHECK(called.load() == 1);
+  }
+
+  TEST_CASE("Server serve function coalesce dropped")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+    static std::atomic<int> called{0};
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        regist("block", [](wsrpc::rawjson_view_t) -> return_t {
+          std::this_thread::sleep_for(std::chrono::milliseconds(300));
+          return wsrpc::package_t{"null", {}};
+        });
+        regist(
+          "expensive",
+          [](wsrpc::rawjson_view_t params) -> return_t {
+            called++;
+            return wsrpc::package_t{wsrpc::rawjson_t(params), {}};
+          },
+          {.coalesce = true});
+      }
+    };
+
+    // A single worker, so that the first call is still queued when its connection closes
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .threads_num = 1})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    first = await session.ws_connect(url)
+    await first.send_str('{\"id\":\"b\",\"method\":\"block\",\"params\":null}')
+    await asyncio.sleep(0.05)
+    await first.send_str('{\"id\":\"0\",\"method\":\"expensive\",\"params\":[1]}')
+    await asyncio.sleep(0.05)
+    await first.close()
+    second = await session.ws_connect(url)
+    await second.send_str('{\"id\":\"1\",\"method\":\"expensive\",\"params\":[1]}')
+    res = await asyncio.wait_for(second.receive_str(), 5)
+    print(res, end='')
+    await second.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // The first call went with its connection, identical ones after it still run
+    CHECK(*ret == R"({"id":"1","result":[1]})");
+    CHECK(called.load() == 1);
+  }
+
+  TEST_CASE("Server serve function shared apps")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+    static std::atomic<int> built{0};
+    static std::atomic<int> sessions{0};
+
+    struct AppT : wsrpc::App
+    {
+      AppT() : App()
+      {
+        built++;
+        regist("whoami", [](wsrpc::rawjson_view_t, wsrpc::context_t& ctx) -> return_t {
+          return wsrpc::package_t{std::to_string(*std::static_pointer_cast<int>(ctx.session)), {}};
+        });
+      }
+
+      std::shared_ptr<void> make_session() override
+      {
+        return std::make_shared<int>(++sessions);
+      }
+    };
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<AppT>({.host = host, .port = port, .shared_apps = 1})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(url):
+    session = aiohttp.ClientSession()
+    clients = [await session.ws_connect(url) for i in range(3)]
+    for client in clients:
+        await client.send_str('{\"id\":\"1\",\"method\":\"whoami\",\"params\":null}')
+    res = sorted([await client.receive_str() for client in clients])
+    print(' '.join(res), end='')
+    for client in clients:
+        await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" ws://{}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // One app built for all, each connection with its own session
+    CHECK(*ret == R"({"id":"1","result":1} {"id":"1","result":2} {"id":"1","result":3})");
+    CHECK(built.load() == 1);
+  }
+
+  TEST_CASE("Server serve function metrics")
+  {
+    static const auto host = "127.0.0.1";
+    static const auto port = 9001;
+
+    auto s = std::jthread([&]() { CHECK_NOTHROW(wsrpc::serve<wsrpc::App>({.host = host, .port = port})); });
+
+    auto code = R"(
+import sys
+import asyncio
+import aiohttp
+
+async def main(host):
+    session = aiohttp.ClientSession()
+    client = await session.ws_connect('ws://' + host)
+    await client.send_str('{\"id\":\"1\",\"method\":\"echo\",\"params\":null}')
+    await client.receive_str()
+    resp = await session.get('http://' + host + '/metrics')
+    text = await resp.text()
+    names = ('wsrpc_connections_opened_total ', 'wsrpc_call_exec_seconds_count{method=\"echo\"} ')
+    print(' '.join(line for line in text.splitlines() if line.startswith(names)), end='')
+    await client.close()
+    await session.close()
+
+if __name__ == '__main__':
+    target = sys.argv[1]
+    asyncio.run(main(target))
+)";
+    auto ret = execute(fmt::format("python -c \"{}\" {}:{}", code, host, port).c_str());
+    REQUIRE(ret);
+    // Served over plain HTTP on the same port
+    CHECK(*ret == R"(wsrpc_connections_opened_total 1 wsrpc_call_exec_seconds_count{method="echo"} 1)");
+  }
+
   TEST_CASE("Server serve function data")
   {
     static const auto path = std::filesystem::path(ROOTPATH);
@@ -136,7 +1335,7 @@ if __name__ == '__main__':
         glz::json_t json_commit;
         glz::json_t json_tree;
         wsrpc::binary_t jpg_404;
-        wsrpc::binary_t jpg_landing;
+        std::shared_ptr<const wsrpc::binary_t> jpg_landing;
       };
 
       static Data load()
@@ -146,7 +1345,7 @@ if __name__ == '__main__':
           .json_commit = glz::read_json<glz::json_t>(wsrpc::read_text(_path / "latest-commit@pbr-book.json")).value(),
           .json_tree = glz::read_json<glz::json_t>(wsrpc::read_text(_path / "tree-commit-info@pbr-book.json")).value(),
           .jpg_404 = wsrpc::read_bytes(_path / "404@pbr-book.jpg"),
-          .jpg_landing = wsrpc::read_bytes(_path / "landing@pbr-book.jpg"),
+          .jpg_landing = std::make_shared<const wsrpc::binary_t>(wsrpc::read_bytes(_path / "landing@pbr-book.jpg")),
         };
       }
 
@@ -155,11 +1354,11 @@ if __name__ == '__main__':
       AppT() : App()
       {
         regist("test0", [&](const wsrpc::rawjson_t&) -> wsrpc::package_t {
-          return {data.json_tree.dump().value(), {data.jpg_landing}};
+          return {data.json_tree.dump().value(), {wsrpc::attach_t(data.jpg_landing).compress(false)}};
         });
         regist("test1", [&](const wsrpc::rawjson_t&) -> wsrpc::package_t {
           auto j = data.json_tree;
-          j["data"] = glz::write_base64(wsrpc::sv(data.jpg_landing));
+          j["data"] = glz::write_base64(wsrpc::sv(*data.jpg_landing));
           return {j.dump().value(), {}};
         });
       }
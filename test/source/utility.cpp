@@ -1,9 +1,14 @@
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <doctest/doctest.h>
+#include <spdlog/sinks/ostream_sink.h>
 
 #include <wsrpc/utility.hpp>
 
@@ -23,6 +28,11 @@ TEST_SUITE("utility")
     CHECK_FALSE(data_sv.empty());
     CHECK(data_sv.size() == 5);
     CHECK(std::string(data_sv) == "Hello");
+
+    // Test with span
+    auto span_sv = wsrpc::sv(std::span<const std::byte>(data).first(4));
+    CHECK(span_sv.size() == 4);
+    CHECK(std::string(span_sv) == "Hell");
   }
 
   TEST_CASE("ScheduledTask schedule")
@@ -72,4 +82,87 @@ TEST_SUITE("utility")
     // Should only execute once (the rescheduled one)
     CHECK(execution_count.load() == 1);
   }
-}
\ No newline at end of file
+
+  TEST_CASE("MpscQueue push and drain")
+  {
+    wsrpc::MpscQueue<std::string> queue;
+
+    // Only the first push into an empty queue asks for a wakeup
+    CHECK(queue.push("a"));
+    CHECK_FALSE(queue.push("b"));
+    CHECK_FALSE(queue.push("c"));
+
+    std::vector<std::string> drained;
+    auto n = queue.drain([&drained](std::string&& s) { drained.push_back(std::move(s)); });
+    CHECK(n == 3);
+    CHECK(drained == std::vector<std::string>{"a", "b", "c"});
+
+    // Drained queue is empty again
+    CHECK(queue.drain([](std::string&&) {}) == 0);
+    CHECK(queue.push("d"));
+  }
+
+  TEST_CASE("MpscQueue concurrent producers" * doctest::timeout(5.0))
+  {
+    wsrpc::MpscQueue<int> queue;
+    const int num_threads = 4;
+    const int operations_per_thread = 10000;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&queue]() {
+        for (int i = 0; i < operations_per_thread; ++i) queue.push(1);
+      });
+    }
+
+    int sum = 0;
+    while (sum < num_threads * operations_per_thread) {
+      queue.drain([&sum](int&& v) { sum += v; });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    CHECK(sum == num_threads * operations_per_thread);
+  }
+
+  TEST_CASE("Timer logs only above the logger level")
+  {
+    auto previous = spdlog::default_logger();
+    std::ostringstream out;
+    auto logger = std::make_shared<spdlog::logger>("timer", std::make_shared<spdlog::sinks::ostream_sink_mt>(out));
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+
+    {
+      wsrpc::Timer timer("quiet");
+    }
+    CHECK(out.str().empty());
+    {
+      wsrpc::Timer timer("loud", spdlog::level::warn);
+    }
+    CHECK(out.str().find("loud took") != std::string::npos);
+
+    spdlog::set_default_logger(previous);
+  }
+
+  TEST_CASE("Arena scope")
+  {
+    void* first = nullptr;
+    {
+      wsrpc::Arena::Scope scope;
+      first = scope.resource()->allocate(64);
+      {
+        // Nested scopes share the arena and leave it to the outermost one
+        wsrpc::Arena::Scope inner;
+        CHECK(inner.resource() == scope.resource());
+        CHECK(inner.resource()->allocate(64) != first);
+      }
+      CHECK(scope.resource()->allocate(64) != first);
+      // Past the initial block, from the heap until released
+      std::pmr::vector<std::byte> big(2 * wsrpc::Arena::initial, scope.resource());
+    }
+    wsrpc::Arena::Scope scope;
+    CHECK(scope.resource()->allocate(64) == first);
+  }
+}